@@ -1,13 +1,74 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "compression/huffman.h"
 #include "compression/lz77.h"
 #include "compression/lz78.h"
+#include "compression/fse.h"
+#include "compression/lzh.h"
+#include "sort/sort_quick.h"
+#include "utils/mem.h"
+
+/*
+ * Compression methods.
+ */
+struct compression_method_t {
+  const char *name;
+  const char *label;
+  int (*compression)(const char *, const char *);
+  int (*uncompression)(const char *, const char *);
+};
+
+static const struct compression_method_t compression_methods[] = {
+  { "huffman",  "Huffman",  huffman_encode,   huffman_decode },
+  { "fse",      "FSE",      fse_encode,       fse_decode },
+  { "lz77",     "LZ77",     lz77_compress,    lz77_uncompress },
+  { "lz78",     "LZ78",     lz78_compress,    lz78_uncompress },
+  { "lzh",      "LZH",      lzh_compress,     lzh_uncompress },
+};
+
+#define NB_COMPRESSION_METHODS    (sizeof(compression_methods) / sizeof(compression_methods[0]))
+
+/*
+ * Benchmark defaults (warmup and measured runs of every method on every file).
+ */
+#define BENCH_WARMUP              1
+#define BENCH_REPEATS             5
+#define BENCH_MAX_REPEATS         1000
+
+/*
+ * Benchmark result of a method on a file (times in seconds, one per measured run).
+ */
+struct bench_result_t {
+  const char *method;
+  char *file;
+  off_t input_size;
+  off_t compressed_size;
+  double *compression_times;
+  double *uncompression_times;
+  long peak_rss;
+  int verified;
+};
+
+/*
+ * Wall clock time in seconds.
+ */
+static double wall_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 /*
  * Compression test.
@@ -18,8 +79,7 @@ static void compression_test(const char *input_file, const char *compressed_file
 {
   off_t input_size, output_size;
   struct stat statbuf;
-  clock_t start, end;
-  double t1, t2;
+  double start, t1, t2;
   int err;
 
   /* get initial size */
@@ -29,16 +89,14 @@ static void compression_test(const char *input_file, const char *compressed_file
   input_size = statbuf.st_size;
 
   /* compression */
-  start = clock();
+  start = wall_time();
   compression(input_file, compressed_file);
-  end = clock();
-  t1 = (double) (end - start) / CLOCKS_PER_SEC;
+  t1 = wall_time() - start;
 
   /* uncompression */
-  start = clock();
+  start = wall_time();
   uncompression(compressed_file, uncompressed_file);
-  end = clock();
-  t2 = (double) (end - start) / CLOCKS_PER_SEC;
+  t2 = wall_time() - start;
 
   /* get output size */
   err = stat(compressed_file, &statbuf);
@@ -53,30 +111,438 @@ static void compression_test(const char *input_file, const char *compressed_file
   printf("Uncompression time : %f\n", t2);
 }
 
+/*
+ * Check that two files have the same content.
+ */
+static int files_equal(const char *file1, const char *file2)
+{
+  unsigned char buf1[64 * 1024], buf2[64 * 1024];
+  FILE *fp1, *fp2;
+  size_t n1, n2;
+  int ret = 0;
+
+  fp1 = fopen(file1, "rb");
+  fp2 = fopen(file2, "rb");
+  if (!fp1 || !fp2)
+    goto out;
+
+  do {
+    n1 = fread(buf1, 1, sizeof(buf1), fp1);
+    n2 = fread(buf2, 1, sizeof(buf2), fp2);
+    if (n1 != n2 || memcmp(buf1, buf2, n1) != 0)
+      goto out;
+  } while (n1 > 0);
+
+  ret = !ferror(fp1) && !ferror(fp2);
+out:
+  if (fp1)
+    fclose(fp1);
+  if (fp2)
+    fclose(fp2);
+
+  return ret;
+}
+
+/*
+ * Compare 2 doubles.
+ */
+static int double_compare(const void *d1, const void *d2)
+{
+  double x1 = *((const double *) d1);
+  double x2 = *((const double *) d2);
+
+  return (x1 > x2) - (x1 < x2);
+}
+
+/*
+ * Compare 2 strings (for an array of strings).
+ */
+static int string_compare(const void *s1, const void *s2)
+{
+  return strcmp(*((char * const *) s1), *((char * const *) s2));
+}
+
+/*
+ * Percentile of sorted values (linear interpolation between closest ranks).
+ */
+static double percentile(const double *values, int n, double p)
+{
+  double rank = p / 100.0 * (n - 1);
+  int i = (int) rank;
+
+  if (i + 1 >= n)
+    return values[n - 1];
+
+  return values[i] + (rank - i) * (values[i + 1] - values[i]);
+}
+
+/*
+ * Throughput percentile in MB/s of a method on a file.
+ */
+static double bench_throughput(const struct bench_result_t *result, const double *times, int repeats, double p)
+{
+  double *mbs, ret;
+  int i;
+
+  mbs = (double *) xmalloc(sizeof(double) * repeats);
+  for (i = 0; i < repeats; i++)
+    mbs[i] = times[i] > 0 ? result->input_size / times[i] / 1e6 : 0;
+
+  sort_quick(mbs, repeats, sizeof(double), double_compare);
+  ret = percentile(mbs, repeats, p);
+  free(mbs);
+
+  return ret;
+}
+
+/*
+ * Run a method on a file in a child process (so that peak memory usage is its own) : warmup runs, then measured
+ * runs. Every run is verified.
+ */
+static void bench_run(const struct compression_method_t *method, const char *input_file, const char *compressed_file,
+                      const char *uncompressed_file, int warmup, int repeats, struct bench_result_t *result)
+{
+  size_t len = sizeof(int) + sizeof(off_t) + 2 * sizeof(double) * repeats, n;
+  double start, tc, tu;
+  struct rusage usage;
+  struct stat statbuf;
+  int fds[2], status, verified, i;
+  unsigned char *buf;
+  ssize_t ret;
+  pid_t pid;
+
+  result->verified = 0;
+  result->peak_rss = 0;
+  result->compressed_size = 0;
+  if (pipe(fds) != 0)
+    return;
+
+  pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+
+  /* child : run method and send results (verified, compressed size, compression and uncompression times) */
+  if (pid == 0) {
+    close(fds[0]);
+    buf = (unsigned char *) xmalloc(len);
+
+    for (i = 0, verified = 1; verified && i < warmup + repeats; i++) {
+      start = wall_time();
+      verified = method->compression(input_file, compressed_file) == 0;
+      tc = wall_time() - start;
+
+      start = wall_time();
+      verified = verified && method->uncompression(compressed_file, uncompressed_file) == 0;
+      tu = wall_time() - start;
+
+      verified = verified && files_equal(input_file, uncompressed_file);
+      if (i >= warmup) {
+        memcpy(buf + sizeof(int) + sizeof(off_t) + sizeof(double) * (i - warmup), &tc, sizeof(double));
+        memcpy(buf + sizeof(int) + sizeof(off_t) + sizeof(double) * (repeats + i - warmup), &tu, sizeof(double));
+      }
+    }
+
+    memcpy(buf, &verified, sizeof(int));
+    statbuf.st_size = 0;
+    stat(compressed_file, &statbuf);
+    memcpy(buf + sizeof(int), &statbuf.st_size, sizeof(off_t));
+
+    for (n = 0; n < len && (ret = write(fds[1], buf + n, len - n)) > 0; n += ret);
+    _exit(n == len ? 0 : 1);
+  }
+
+  /* parent : read results */
+  close(fds[1]);
+  buf = (unsigned char *) xmalloc(len);
+  for (n = 0; n < len && (ret = read(fds[0], buf + n, len - n)) > 0; n += ret);
+  close(fds[0]);
+
+  /* wait for child (a crash is a failure) */
+  if (wait4(pid, &status, 0, &usage) == pid) {
+    result->peak_rss = usage.ru_maxrss;
+    if (n == len && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      memcpy(&result->verified, buf, sizeof(int));
+      memcpy(&result->compressed_size, buf + sizeof(int), sizeof(off_t));
+      memcpy(result->compression_times, buf + sizeof(int) + sizeof(off_t), sizeof(double) * repeats);
+      memcpy(result->uncompression_times, buf + sizeof(int) + sizeof(off_t) + sizeof(double) * repeats,
+             sizeof(double) * repeats);
+    }
+  }
+
+  free(buf);
+}
+
+/*
+ * List regular files of a directory (sorted by name).
+ */
+static char **bench_list_files(const char *dir, size_t *nb_files)
+{
+  char **files = NULL, path[4096];
+  struct stat statbuf;
+  struct dirent *entry;
+  DIR *dp;
+
+  *nb_files = 0;
+  dp = opendir(dir);
+  if (!dp)
+    return NULL;
+
+  while ((entry = readdir(dp)) != NULL) {
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    if (stat(path, &statbuf) != 0 || !S_ISREG(statbuf.st_mode))
+      continue;
+
+    files = (char **) xrealloc(files, sizeof(char *) * (*nb_files + 1));
+    files[(*nb_files)++] = xstrdup(entry->d_name);
+  }
+
+  closedir(dp);
+  sort_quick(files, *nb_files, sizeof(char *), string_compare);
+
+  return files;
+}
+
+/*
+ * Write a JSON string.
+ */
+static void json_print_string(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      fprintf(fp, "\\u%04x", (unsigned char) *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+/*
+ * Write throughput statistics of a run in JSON.
+ */
+static void json_print_throughput(FILE *fp, const char *name, const struct bench_result_t *result,
+                                  const double *times, int repeats)
+{
+  fprintf(fp, "      \"%s\": { \"median_mbs\": %.3f, \"p10_mbs\": %.3f, \"p90_mbs\": %.3f, \"min_mbs\": %.3f, "
+          "\"max_mbs\": %.3f }", name, bench_throughput(result, times, repeats, 50),
+          bench_throughput(result, times, repeats, 10), bench_throughput(result, times, repeats, 90),
+          bench_throughput(result, times, repeats, 0), bench_throughput(result, times, repeats, 100));
+}
+
+/*
+ * Write benchmark results in JSON.
+ */
+static void bench_print_json(FILE *fp, const char *corpus, int warmup, int repeats, struct bench_result_t *results,
+                             size_t nb_results)
+{
+  size_t i;
+
+  fprintf(fp, "{\n  \"corpus\": ");
+  json_print_string(fp, corpus);
+  fprintf(fp, ",\n  \"warmup\": %d,\n  \"repeats\": %d,\n  \"results\": [\n", warmup, repeats);
+
+  for (i = 0; i < nb_results; i++) {
+    fprintf(fp, "    {\n      \"method\": \"%s\",\n      \"file\": ", results[i].method);
+    json_print_string(fp, results[i].file);
+    fprintf(fp, ",\n      \"size\": %lld,\n      \"compressed_size\": %lld,\n      \"ratio\": %.4f,\n",
+            (long long) results[i].input_size, (long long) results[i].compressed_size,
+            results[i].compressed_size > 0 ? (double) results[i].input_size / results[i].compressed_size : 0);
+    fprintf(fp, "      \"verified\": %s,\n      \"peak_rss_kb\": %ld,\n", results[i].verified ? "true" : "false",
+            results[i].peak_rss);
+    json_print_throughput(fp, "compression", &results[i], results[i].compression_times, repeats);
+    fprintf(fp, ",\n");
+    json_print_throughput(fp, "uncompression", &results[i], results[i].uncompression_times, repeats);
+    fprintf(fp, "\n    }%s\n", i + 1 < nb_results ? "," : "");
+  }
+
+  fprintf(fp, "  ]\n}\n");
+}
+
+/*
+ * Benchmark methods on every file of a corpus directory (method = NULL for all methods, json_file = NULL for no
+ * JSON output). Returns 0 if every run has been verified.
+ */
+static int benchmark(const char *corpus, const char *method, int warmup, int repeats, const char *json_file)
+{
+  char tmp_dir[] = "/tmp/algo-bench-XXXXXX", compressed_file[64], uncompressed_file[64], path[4096];
+  struct bench_result_t *results = NULL;
+  size_t nb_files, nb_results = 0, i, j;
+  struct stat statbuf;
+  char **files;
+  int ret = 0;
+  FILE *fp;
+
+  /* list corpus files */
+  files = bench_list_files(corpus, &nb_files);
+  if (!nb_files) {
+    fprintf(stderr, "No file in corpus directory %s\n", corpus);
+    xfree(files);
+    return 1;
+  }
+
+  /* temporary files */
+  if (!mkdtemp(tmp_dir)) {
+    perror("mkdtemp");
+    for (i = 0; i < nb_files; i++)
+      free(files[i]);
+    free(files);
+    return 1;
+  }
+  snprintf(compressed_file, sizeof(compressed_file), "%s/compressed", tmp_dir);
+  snprintf(uncompressed_file, sizeof(uncompressed_file), "%s/uncompressed", tmp_dir);
+
+  printf("%-8s %-24s %12s %12s %8s %12s %12s %10s\n", "method", "file", "size", "compressed", "ratio", "comp MB/s",
+         "uncomp MB/s", "rss KB");
+
+  /* run every method on every file */
+  for (i = 0; i < NB_COMPRESSION_METHODS; i++) {
+    if (method && strcmp(method, compression_methods[i].name) != 0)
+      continue;
+
+    for (j = 0; j < nb_files; j++) {
+      snprintf(path, sizeof(path), "%s/%s", corpus, files[j]);
+      if (stat(path, &statbuf) != 0)
+        continue;
+
+      results = (struct bench_result_t *) xrealloc(results, sizeof(struct bench_result_t) * (nb_results + 1));
+      results[nb_results].method = compression_methods[i].name;
+      results[nb_results].file = files[j];
+      results[nb_results].input_size = statbuf.st_size;
+      results[nb_results].compression_times = (double *) xmalloc(sizeof(double) * repeats);
+      results[nb_results].uncompression_times = (double *) xmalloc(sizeof(double) * repeats);
+      memset(results[nb_results].compression_times, 0, sizeof(double) * repeats);
+      memset(results[nb_results].uncompression_times, 0, sizeof(double) * repeats);
+
+      bench_run(&compression_methods[i], path, compressed_file, uncompressed_file, warmup, repeats,
+                &results[nb_results]);
+
+      printf("%-8s %-24s %12lld %12lld %8.3f %12.2f %12.2f %10ld %s\n", compression_methods[i].name, files[j],
+             (long long) statbuf.st_size, (long long) results[nb_results].compressed_size,
+             results[nb_results].compressed_size > 0
+               ? (double) statbuf.st_size / results[nb_results].compressed_size : 0,
+             bench_throughput(&results[nb_results], results[nb_results].compression_times, repeats, 50),
+             bench_throughput(&results[nb_results], results[nb_results].uncompression_times, repeats, 50),
+             results[nb_results].peak_rss, results[nb_results].verified ? "OK" : "FAILED");
+      fflush(stdout);
+
+      if (!results[nb_results].verified)
+        ret = 1;
+      nb_results++;
+    }
+  }
+
+  /* remove temporary files */
+  unlink(compressed_file);
+  unlink(uncompressed_file);
+  rmdir(tmp_dir);
+
+  /* write JSON results */
+  if (json_file) {
+    fp = fopen(json_file, "w");
+    if (fp) {
+      bench_print_json(fp, corpus, warmup, repeats, results, nb_results);
+      if (fclose(fp) != 0)
+        ret = 1;
+    } else {
+      perror(json_file);
+      ret = 1;
+    }
+  }
+
+  /* free results */
+  for (i = 0; i < nb_results; i++) {
+    free(results[i].compression_times);
+    free(results[i].uncompression_times);
+  }
+  for (i = 0; i < nb_files; i++)
+    free(files[i]);
+  xfree(results);
+  free(files);
+
+  return ret;
+}
+
 /*
  * Usage.
  */
 static void usage(const char *name)
 {
-  fprintf(stderr, "%s input_file output_file new_file\n", name);
+  size_t i;
+
+  fprintf(stderr, "%s [-c method] input_file output_file new_file\n", name);
+  fprintf(stderr, "%s -b corpus_dir [-c method] [-w warmup_runs] [-r runs] [-o json_file]\n", name);
+  fprintf(stderr, "methods :");
+  for (i = 0; i < NB_COMPRESSION_METHODS; i++)
+    fprintf(stderr, " %s", compression_methods[i].name);
+  fprintf(stderr, " (default : all)\n");
 }
 
 int main(int argc, char **argv)
 {
-  /* check arguments */
-  if (argc != 4) {
+  const char *method = NULL, *corpus = NULL, *json_file = NULL;
+  int c, warmup = BENCH_WARMUP, repeats = BENCH_REPEATS;
+  size_t i;
+
+  /* parse options */
+  while ((c = getopt(argc, argv, "c:b:w:r:o:")) != -1) {
+    switch (c) {
+      case 'c':
+        method = optarg;
+        break;
+      case 'b':
+        corpus = optarg;
+        break;
+      case 'w':
+        warmup = atoi(optarg);
+        break;
+      case 'r':
+        repeats = atoi(optarg);
+        break;
+      case 'o':
+        json_file = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  /* check method */
+  for (i = 0; method && i < NB_COMPRESSION_METHODS && strcmp(method, compression_methods[i].name) != 0; i++);
+  if (method && i == NB_COMPRESSION_METHODS) {
     usage(argv[0]);
     return 1;
   }
 
-  /* huffman */
-  compression_test(argv[1], argv[2], argv[3], "Huffman", huffman_encode, huffman_decode);
+  /* benchmark mode */
+  if (corpus) {
+    if (argc != optind || warmup < 0 || repeats <= 0 || repeats > BENCH_MAX_REPEATS) {
+      usage(argv[0]);
+      return 1;
+    }
 
-  /* lz77 */
-  compression_test(argv[1], argv[2], argv[3], "LZ77", lz77_compress, lz77_uncompress);
+    return benchmark(corpus, method, warmup, repeats, json_file);
+  }
 
-  /* lz78 */
-  compression_test(argv[1], argv[2], argv[3], "LZ78", lz78_compress, lz78_uncompress);
+  /* check arguments */
+  if (argc - optind != 3) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  /* run selected methods */
+  for (i = 0; i < NB_COMPRESSION_METHODS; i++) {
+    if (method && strcmp(method, compression_methods[i].name) != 0)
+      continue;
+
+    compression_test(argv[optind], argv[optind + 1], argv[optind + 2], compression_methods[i].label,
+                     compression_methods[i].compression, compression_methods[i].uncompression);
+  }
 
   return 0;
 }
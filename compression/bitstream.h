@@ -0,0 +1,167 @@
+#ifndef _BITSTREAM_H_
+#define _BITSTREAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stream.h"
+
+/*
+ * Size of the input buffer of a bit reader reading a stream.
+ */
+#define BIT_IO_BUF_SIZE           (64 * 1024)
+
+/*
+ * Bit reader (most significant bit first).
+ */
+struct bit_reader_t {
+  struct stream_t *stream;
+  unsigned char *io_buf;
+  const unsigned char *buf;
+  size_t pos;
+  size_t len;
+  uint64_t bits;
+  int nb_bits;
+};
+
+/*
+ * Bit writer (most significant bit first) : codes are accumulated in a 64 bits buffer and flushed
+ * 32 bits at a time. Without a stream, the buffer must be large enough to hold the whole output.
+ */
+struct bit_writer_t {
+  struct stream_t *stream;
+  unsigned char *buf;
+  size_t size;
+  size_t pos;
+  uint64_t bits;
+  int nb_bits;
+};
+
+/*
+ * Init a bit writer (stream = NULL to write in memory).
+ */
+static inline void bit_writer_init(struct bit_writer_t *bw, struct stream_t *stream, unsigned char *buf, size_t size)
+{
+  bw->stream = stream;
+  bw->buf = buf;
+  bw->size = size;
+  bw->pos = 0;
+  bw->bits = 0;
+  bw->nb_bits = 0;
+}
+
+/*
+ * Write a code to a bit writer.
+ */
+static inline void bit_writer_put(struct bit_writer_t *bw, uint32_t code, int len)
+{
+  uint32_t w;
+
+  /* add code to bit buffer */
+  bw->bits = (bw->bits << len) | code;
+  bw->nb_bits += len;
+
+  /* flush a 32 bits word */
+  if (bw->nb_bits >= 32) {
+    bw->nb_bits -= 32;
+    w = bw->bits >> bw->nb_bits;
+    bw->buf[bw->pos] = w >> 24;
+    bw->buf[bw->pos + 1] = w >> 16;
+    bw->buf[bw->pos + 2] = w >> 8;
+    bw->buf[bw->pos + 3] = w;
+    bw->pos += 4;
+
+    /* output buffer full : write it */
+    if (bw->stream && bw->pos >= bw->size) {
+      stream_write(bw->stream, bw->buf, bw->pos);
+      bw->pos = 0;
+    }
+  }
+}
+
+/*
+ * Flush a bit writer (last byte is padded with zeros).
+ */
+static inline void bit_writer_flush(struct bit_writer_t *bw)
+{
+  /* write remaining bits */
+  for (; bw->nb_bits > 0; bw->nb_bits -= 8)
+    bw->buf[bw->pos++] = (bw->bits << (64 - bw->nb_bits)) >> 56;
+  bw->nb_bits = 0;
+
+  /* write output buffer */
+  if (bw->stream && bw->pos > 0) {
+    stream_write(bw->stream, bw->buf, bw->pos);
+    bw->pos = 0;
+  }
+}
+
+/*
+ * Init a bit reader (stream = NULL to read from memory, else io_buf must hold BIT_IO_BUF_SIZE bytes).
+ */
+static inline void bit_reader_init(struct bit_reader_t *br, struct stream_t *stream, unsigned char *io_buf,
+                            const unsigned char *buf, size_t len)
+{
+  br->stream = stream;
+  br->io_buf = io_buf;
+  br->buf = buf;
+  br->pos = 0;
+  br->len = len;
+  br->bits = 0;
+  br->nb_bits = 0;
+}
+
+/*
+ * Refill a bit reader (at least 56 bits are available after a refill, missing bits at end of input are zeros).
+ */
+static inline void bit_reader_refill(struct bit_reader_t *br)
+{
+  uint64_t v;
+
+  /* fast path : load 8 bytes at once and keep whole bytes */
+  if (br->pos + 8 <= br->len) {
+    memcpy(&v, br->buf + br->pos, sizeof(uint64_t));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    br->bits |= v >> br->nb_bits;
+    br->pos += (63 - br->nb_bits) >> 3;
+    br->nb_bits |= 56;
+    return;
+  }
+
+  while (br->nb_bits <= 56) {
+    /* read next input buffer */
+    if (br->pos >= br->len) {
+      br->len = br->stream ? stream_read(br->stream, br->io_buf, BIT_IO_BUF_SIZE) : 0;
+      br->buf = br->io_buf;
+      br->pos = 0;
+
+      /* end of input : pad with zeros */
+      if (br->len == 0) {
+        br->nb_bits = 64;
+        return;
+      }
+    }
+
+    br->bits |= (uint64_t) br->buf[br->pos++] << (56 - br->nb_bits);
+    br->nb_bits += 8;
+  }
+}
+
+/*
+ * Read nb_bits bits (nb_bits = 0 is allowed, the caller must make sure enough bits are available).
+ */
+static inline uint32_t bit_reader_get(struct bit_reader_t *br, int nb_bits)
+{
+  uint32_t v;
+
+  v = (br->bits >> 1) >> (63 - nb_bits);
+  br->bits <<= nb_bits;
+  br->nb_bits -= nb_bits;
+
+  return v;
+}
+
+#endif
@@ -0,0 +1,576 @@
+/*
+ * FSE (Finite State Entropy) = table based asymmetric numeral systems (tANS) entropy coder.
+ * Unlike huffman coding, a symbol can cost a fractional number of bits, which matters a lot on skewed
+ * distributions (a symbol of probability 0.9 costs 0.15 bit instead of 1 bit).
+ * 1 - input is split in blocks, and frequencies of each block are computed
+ * 2 - frequencies are normalized so that they sum to a power of 2 (= number of states of the table)
+ * 3 - symbols are spread in the table, each symbol gets as many states as its normalized frequency
+ * 4 - block is encoded backward : each symbol moves the encoder from a state to the next one and outputs
+ *     the low bits of the state. Decoder reads the final state and walks the table forward.
+ * 5 - every block is written with its normalized frequencies (so decoder will be able to rebuild the same table)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "fse.h"
+#include "stream.h"
+#include "bitstream.h"
+#include "../utils/histogram.h"
+#include "../utils/mem.h"
+
+#define NB_SYMBOLS                HISTOGRAM_SIZE
+#define FSE_MAGIC                 "FSES"
+#define FSE_MAGIC_SIZE            4
+
+/*
+ * Table log = log2 of number of states. Small blocks use smaller tables (cheaper to describe).
+ */
+#define FSE_TABLE_LOG             11
+#define FSE_MIN_TABLE_LOG         5
+#define FSE_MAX_TABLE_LOG         12
+
+/*
+ * Maximum size of a block header = table log, range of used symbols and normalized frequencies (varints).
+ */
+#define FSE_HEADER_MAX_SIZE       (3 + NB_SYMBOLS * 2)
+
+/*
+ * Maximum size of an encoded block (every symbol costs at most table log bits).
+ */
+#define fse_block_bound(len)      (FSE_HEADER_MAX_SIZE + ((len) * FSE_MAX_TABLE_LOG + 7) / 8)
+
+#define fse_highbit(x)            (31 - __builtin_clz(x))
+
+/*
+ * Encoding transform of a symbol.
+ */
+struct fse_symbol_t {
+  uint32_t delta_nb_bits;
+  int delta_find_state;
+};
+
+/*
+ * Decoding table entry.
+ */
+struct fse_entry_t {
+  uint16_t new_state;
+  unsigned char symbol;
+  unsigned char nb_bits;
+};
+
+/*
+ * Choose table log of a block.
+ */
+static int fse_table_log(size_t len, int nb_symbols)
+{
+  int table_log = FSE_TABLE_LOG;
+
+  while (table_log > FSE_MIN_TABLE_LOG && ((size_t) 1 << (table_log - 1)) >= len)
+    table_log--;
+  while ((1 << table_log) < nb_symbols)
+    table_log++;
+
+  return table_log;
+}
+
+/*
+ * Normalize frequencies so that they sum to 2^table_log (every used symbol keeps at least 1 state).
+ * Rounding errors are fixed on the symbols where they cost the less.
+ */
+static void fse_normalize(size_t *freq, size_t total, int table_log, int *norm)
+{
+  int sum = 0, i, best;
+
+  /* scale frequencies */
+  for (i = 0; i < NB_SYMBOLS; i++) {
+    norm[i] = 0;
+    if (freq[i]) {
+      norm[i] = (freq[i] * ((size_t) 1 << table_log) + total / 2) / total;
+      if (norm[i] < 1)
+        norm[i] = 1;
+    }
+
+    sum += norm[i];
+  }
+
+  /* too many states : remove a state where it costs the less (= lowest freq / (norm - 1)) */
+  for (; sum > 1 << table_log; sum--) {
+    for (i = 0, best = -1; i < NB_SYMBOLS; i++)
+      if (norm[i] > 1 && (best < 0 || freq[i] * (norm[best] - 1) < freq[best] * (norm[i] - 1)))
+        best = i;
+
+    norm[best]--;
+  }
+
+  /* not enough states : add a state where it gains the most (= highest freq / norm) */
+  for (; sum < 1 << table_log; sum++) {
+    for (i = 0, best = -1; i < NB_SYMBOLS; i++)
+      if (norm[i] && (best < 0 || freq[i] * norm[best] > freq[best] * norm[i]))
+        best = i;
+
+    norm[best]++;
+  }
+}
+
+/*
+ * Spread symbols in the table (= symbol of each state).
+ */
+static void fse_spread_symbols(int *norm, int table_log, unsigned char *symbols)
+{
+  int size = 1 << table_log, step = (size >> 1) + (size >> 3) + 3, pos = 0, i, j;
+
+  for (i = 0; i < NB_SYMBOLS; i++) {
+    for (j = 0; j < norm[i]; j++) {
+      symbols[pos] = i;
+      pos = (pos + step) & (size - 1);
+    }
+  }
+}
+
+/*
+ * Build encoding table.
+ */
+static void fse_build_encoding_table(int *norm, int table_log, uint16_t *state_table, struct fse_symbol_t *tt)
+{
+  unsigned char symbols[1 << FSE_MAX_TABLE_LOG];
+  int size = 1 << table_log, cumul[NB_SYMBOLS], total, max_bits, i;
+
+  fse_spread_symbols(norm, table_log, symbols);
+
+  /* sort states by symbol */
+  for (i = 0, total = 0; i < NB_SYMBOLS; i++) {
+    cumul[i] = total;
+    total += norm[i];
+  }
+  for (i = 0; i < size; i++)
+    state_table[cumul[symbols[i]]++] = size + i;
+
+  /* build symbol transforms */
+  for (i = 0, total = 0; i < NB_SYMBOLS; i++) {
+    if (norm[i] == 0)
+      continue;
+
+    if (norm[i] == 1) {
+      tt[i].delta_nb_bits = (table_log << 16) - size;
+      tt[i].delta_find_state = total - 1;
+    } else {
+      max_bits = table_log - fse_highbit(norm[i] - 1);
+      tt[i].delta_nb_bits = (max_bits << 16) - (norm[i] << max_bits);
+      tt[i].delta_find_state = total - norm[i];
+    }
+
+    total += norm[i];
+  }
+}
+
+/*
+ * Build decoding table.
+ */
+static void fse_build_decoding_table(int *norm, int table_log, struct fse_entry_t *table)
+{
+  unsigned char symbols[1 << FSE_MAX_TABLE_LOG];
+  int size = 1 << table_log, next[NB_SYMBOLS], state, i;
+
+  fse_spread_symbols(norm, table_log, symbols);
+
+  for (i = 0; i < NB_SYMBOLS; i++)
+    next[i] = norm[i];
+
+  for (i = 0; i < size; i++) {
+    state = next[symbols[i]]++;
+    table[i].symbol = symbols[i];
+    table[i].nb_bits = table_log - fse_highbit(state);
+    table[i].new_state = (state << table[i].nb_bits) - size;
+  }
+}
+
+/*
+ * Write block header. Returns number of bytes written.
+ */
+static size_t fse_write_header(unsigned char *buf, int *norm, int table_log)
+{
+  int first, last, i, v;
+  size_t n;
+
+  /* find range of used symbols */
+  for (first = 0; !norm[first]; first++);
+  for (last = NB_SYMBOLS - 1; !norm[last]; last--);
+  buf[0] = table_log;
+  buf[1] = first;
+  buf[2] = last;
+
+  /* write normalized frequencies (7 bits per byte, high bit = more bytes) */
+  for (i = first, n = 3; i <= last; i++) {
+    for (v = norm[i]; v >= 0x80; v >>= 7)
+      buf[n++] = (v & 0x7F) | 0x80;
+    buf[n++] = v;
+  }
+
+  return n;
+}
+
+/*
+ * Read block header. Returns number of bytes read or -1 on error.
+ */
+static int fse_read_header(const unsigned char *buf, size_t len, int *norm, int *table_log)
+{
+  int sum, i, v, shift;
+  size_t n;
+
+  /* read table log and range of used symbols */
+  if (len < 3 || buf[0] < FSE_MIN_TABLE_LOG || buf[0] > FSE_MAX_TABLE_LOG || buf[1] > buf[2])
+    return -1;
+  *table_log = buf[0];
+
+  /* read normalized frequencies */
+  memset(norm, 0, sizeof(int) * NB_SYMBOLS);
+  for (i = buf[1], n = 3, sum = 0; i <= buf[2]; i++) {
+    for (v = 0, shift = 0;; shift += 7) {
+      if (n >= len || shift > 14)
+        return -1;
+
+      v |= (buf[n] & 0x7F) << shift;
+      if (!(buf[n++] & 0x80))
+        break;
+    }
+
+    norm[i] = v;
+    sum += v;
+  }
+
+  /* frequencies must fill the table */
+  return sum == 1 << *table_log ? (int) n : -1;
+}
+
+/*
+ * Encode a symbol : output low bits of state and move to next state.
+ */
+#define fse_encode_symbol(state_table, tt, state, symbol, code)                                 \
+  do {                                                                                          \
+    nb_bits = ((state) + (tt)[symbol].delta_nb_bits) >> 16;                                     \
+    (code) = (nb_bits << 16) | ((state) & ((1 << nb_bits) - 1));                                \
+    (state) = (state_table)[((state) >> nb_bits) + (tt)[symbol].delta_find_state];              \
+  } while (0)
+
+/*
+ * Encode a block in memory (dst must hold fse_block_bound(len) bytes, codes must hold len items).
+ */
+static void fse_encode_block(const unsigned char *src, size_t len, unsigned char *dst, size_t *dst_len,
+                             uint32_t *codes)
+{
+  int norm[NB_SYMBOLS], table_log, nb_symbols, nb_bits, i;
+  uint16_t state_table[1 << FSE_MAX_TABLE_LOG];
+  struct fse_symbol_t tt[NB_SYMBOLS];
+  size_t freq[NB_SYMBOLS], n, k;
+  uint32_t state0, state1;
+  struct bit_writer_t bw;
+
+  /* compute frequencies */
+  memset(freq, 0, sizeof(freq));
+  histogram_count(src, len, freq);
+  for (i = 0, nb_symbols = 0; i < NB_SYMBOLS; i++)
+    if (freq[i])
+      nb_symbols++;
+
+  /* normalize frequencies and build table */
+  table_log = fse_table_log(len, nb_symbols);
+  fse_normalize(freq, len, table_log, norm);
+  fse_build_encoding_table(norm, table_log, state_table, tt);
+
+  /* write header */
+  n = fse_write_header(dst, norm, table_log);
+
+  /*
+   * Encode symbols backward with 2 interleaved states (even and odd positions), so that the decoder can
+   * walk 2 independent chains. Bits of each symbol are kept, to be written forward.
+   */
+  state0 = state1 = 1 << table_log;
+  k = len;
+  if (k & 1) {
+    fse_encode_symbol(state_table, tt, state0, src[k - 1], codes[k - 1]);
+    k--;
+  }
+  for (; k > 0; k -= 2) {
+    fse_encode_symbol(state_table, tt, state1, src[k - 1], codes[k - 1]);
+    fse_encode_symbol(state_table, tt, state0, src[k - 2], codes[k - 2]);
+  }
+
+  /* write final states and bits (bits of the last symbol of each state would only rebuild initial states) */
+  bit_writer_init(&bw, NULL, dst + n, fse_block_bound(len) - n);
+  bit_writer_put(&bw, state0 - (1 << table_log), table_log);
+  bit_writer_put(&bw, state1 - (1 << table_log), table_log);
+  for (k = 0; k + 2 < len; k++)
+    bit_writer_put(&bw, codes[k] & 0xFFFF, codes[k] >> 16);
+  bit_writer_flush(&bw);
+
+  *dst_len = n + bw.pos;
+}
+
+/*
+ * Decode next symbol.
+ */
+#define fse_decode_symbol(table, state, br, dst)                                         \
+  do {                                                                                    \
+    (dst) = (table)[state].symbol;                                                        \
+    (state) = (table)[state].new_state + bit_reader_get((br), (table)[state].nb_bits);    \
+  } while (0)
+
+/*
+ * Decode a block in memory.
+ */
+static int fse_decode_block(const unsigned char *src, size_t len, unsigned char *dst, size_t nb_items)
+{
+  struct fse_entry_t table[1 << FSE_MAX_TABLE_LOG];
+  int norm[NB_SYMBOLS], table_log, n;
+  uint32_t state0, state1;
+  struct bit_reader_t br;
+  size_t i;
+
+  /* read header and build table */
+  n = fse_read_header(src, len, norm, &table_log);
+  if (n < 0)
+    return -1;
+  fse_build_decoding_table(norm, table_log, table);
+
+  /* read initial states */
+  bit_reader_init(&br, NULL, NULL, src + n, len - n);
+  bit_reader_refill(&br);
+  state0 = bit_reader_get(&br, table_log);
+  state1 = bit_reader_get(&br, table_log);
+
+  /* decode 4 symbols per refill (4 * FSE_MAX_TABLE_LOG bits <= 56 bits), alternating states */
+  for (i = 0; i + 6 <= nb_items; i += 4) {
+    bit_reader_refill(&br);
+    fse_decode_symbol(table, state0, &br, dst[i]);
+    fse_decode_symbol(table, state1, &br, dst[i + 1]);
+    fse_decode_symbol(table, state0, &br, dst[i + 2]);
+    fse_decode_symbol(table, state1, &br, dst[i + 3]);
+  }
+
+  /* decode remaining symbols */
+  for (; i + 2 < nb_items; i++) {
+    if (br.nb_bits < table_log)
+      bit_reader_refill(&br);
+
+    if (i & 1)
+      fse_decode_symbol(table, state1, &br, dst[i]);
+    else
+      fse_decode_symbol(table, state0, &br, dst[i]);
+  }
+
+  /* last symbol of each state doesn't read any bit */
+  for (; i < nb_items; i++)
+    dst[i] = table[i & 1 ? state1 : state0].symbol;
+
+  return 0;
+}
+
+/*
+ * FSE encoding of a stream.
+ * Output = magic, block size and blocks (number of symbols, encoded size and encoded block), until an empty block.
+ */
+static int fse_encode_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char *buf_input = NULL, *buf_output, *src;
+  uint32_t block_size = FSE_BLOCK_SIZE, len, dst_len;
+  uint32_t *codes;
+  size_t n;
+
+  /* allocate buffers (memory input is encoded in place) */
+  if (input->fp)
+    buf_input = (unsigned char *) xmalloc(FSE_BLOCK_SIZE);
+  buf_output = (unsigned char *) xmalloc(fse_block_bound(FSE_BLOCK_SIZE));
+  codes = (uint32_t *) xmalloc(sizeof(uint32_t) * FSE_BLOCK_SIZE);
+
+  /* write header */
+  stream_write(output, FSE_MAGIC, FSE_MAGIC_SIZE);
+  stream_write(output, &block_size, sizeof(uint32_t));
+
+  for (;;) {
+    /* get next block */
+    if (input->fp) {
+      src = buf_input;
+      len = stream_read(input, buf_input, FSE_BLOCK_SIZE);
+    } else {
+      src = input->buf + input->pos;
+      len = input->len - input->pos < FSE_BLOCK_SIZE ? input->len - input->pos : FSE_BLOCK_SIZE;
+      input->pos += len;
+    }
+
+    /* empty block = end of stream */
+    stream_write(output, &len, sizeof(uint32_t));
+    if (!len || stream_error(output))
+      break;
+
+    /* encode and write block */
+    fse_encode_block(src, len, buf_output, &n, codes);
+    dst_len = n;
+    stream_write(output, &dst_len, sizeof(uint32_t));
+    stream_write(output, buf_output, dst_len);
+  }
+
+  /* free buffers */
+  xfree(buf_input);
+  free(buf_output);
+  free(codes);
+
+  return stream_error(input) || stream_error(output) ? -1 : 0;
+}
+
+/*
+ * FSE decoding of a stream.
+ */
+static int fse_decode_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char magic[FSE_MAGIC_SIZE], *buf_input, *buf_output;
+  uint32_t block_size, len, src_len;
+  int ret = -1;
+
+  /* read header */
+  if (stream_read(input, magic, FSE_MAGIC_SIZE) != FSE_MAGIC_SIZE || memcmp(magic, FSE_MAGIC, FSE_MAGIC_SIZE) != 0
+      || stream_read(input, &block_size, sizeof(uint32_t)) != sizeof(uint32_t))
+    return -1;
+
+  /* check block size */
+  if (!block_size || block_size > FSE_BLOCK_SIZE)
+    return -1;
+
+  /* allocate buffers */
+  buf_input = (unsigned char *) xmalloc(fse_block_bound(block_size));
+  buf_output = (unsigned char *) xmalloc(block_size);
+
+  for (;;) {
+    /* read number of symbols (empty block = end of stream) */
+    if (stream_read(input, &len, sizeof(uint32_t)) != sizeof(uint32_t))
+      goto out;
+    if (!len)
+      break;
+
+    /* read encoded block */
+    if (len > block_size || stream_read(input, &src_len, sizeof(uint32_t)) != sizeof(uint32_t)
+        || src_len > fse_block_bound(block_size) || stream_read(input, buf_input, src_len) != src_len)
+      goto out;
+
+    /* decode and write block */
+    if (fse_decode_block(buf_input, src_len, buf_output, len) != 0
+        || stream_write(output, buf_output, len) != len)
+      goto out;
+  }
+
+  ret = stream_error(output) ? -1 : 0;
+out:
+  /* free buffers */
+  free(buf_input);
+  free(buf_output);
+
+  return ret;
+}
+
+/*
+ * FSE encoding of a file.
+ */
+int fse_encode(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* encode file */
+  ret = fse_encode_data(&input, &output);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * Maximum size of a FSE encoded buffer.
+ */
+size_t fse_encode_bound(size_t len)
+{
+  size_t nb_blocks = (len + FSE_BLOCK_SIZE - 1) / FSE_BLOCK_SIZE;
+
+  return FSE_MAGIC_SIZE + 2 * sizeof(uint32_t) + nb_blocks * (2 * sizeof(uint32_t) + FSE_HEADER_MAX_SIZE + 1)
+    + len * FSE_MAX_TABLE_LOG / 8;
+}
+
+/*
+ * FSE encoding of a buffer (fse_encode_bound(src_len) bytes are always enough).
+ */
+int fse_encode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                      size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = fse_encode_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
+}
+
+/*
+ * FSE decoding of a file.
+ */
+int fse_decode(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* decode file */
+  ret = fse_decode_data(&input, &output);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * FSE decoding of a buffer (fails if decoded data doesn't fit in dst_size bytes).
+ */
+int fse_decode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                      size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = fse_decode_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
+}
@@ -0,0 +1,16 @@
+#ifndef _FSE_H_
+#define _FSE_H_
+
+#include <stdio.h>
+
+#define FSE_BLOCK_SIZE            (128 * 1024)
+
+int fse_encode(const char *input_file, const char *output_file);
+int fse_encode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                      size_t *dst_len);
+size_t fse_encode_bound(size_t len);
+int fse_decode(const char *input_file, const char *output_file);
+int fse_decode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                      size_t *dst_len);
+
+#endif
@@ -4,20 +4,59 @@
  * 2 - build huffman tree (min heap) based on frequencies
  *     -> every letter is a leaf in the heap
  *     -> more frequent letters have shortest code
- * 3 - build binary code of every letter
- * 4 - write header in compressed file = every letter with its frequency (so decompressor will be able to rebuild the tree)
- * 5 - encode file = replace each letter with binary code
+ * 3 - compute code length of every letter (= depth in the tree), limited to HUFF_MAX_CODE_LENGTH bits
+ * 4 - build canonical codes from code lengths (codes of same length are consecutive integers)
+ * 5 - write header in compressed file = number of letters and code lengths (so decompressor will be able to
+ *     rebuild the same canonical codes)
+ * 6 - encode file = replace each letter with binary code
+ *
+ * Files written by the previous format (every letter with its frequency in header) can still be decoded.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
 
+#include "huffman.h"
+#include "stream.h"
+#include "bitstream.h"
+#include "huffman_code.h"
 #include "../data_structures/heap.h"
+#include "../utils/thread_pool.h"
+#include "../utils/histogram.h"
 #include "../utils/mem.h"
 
-#define NB_CHARACTERS             256
-#define BUF_SIZE                  1024
+#define NB_CHARACTERS             HISTOGRAM_SIZE
+#define IO_BUF_SIZE               (64 * 1024)
+
+#define HUFF_MAX_CODE_BITS        32
+
+/*
+ * Canonical header magic (read as an int, it can't be mistaken for the number of nodes of the old header).
+ */
+#define HUFFMAN_MAGIC             "HUFC"
+#define HUFFMAN_BLOCKS_MAGIC      "HUFB"
+#define HUFFMAN_STREAM_MAGIC      "HUFS"
+#define HUFFMAN_MAGIC_SIZE        4
+
+/*
+ * Maximum size of encoded code lengths (= range of used characters + 2 lengths per byte).
+ */
+#define HUFF_LENGTHS_MAX_SIZE     (2 + NB_CHARACTERS / 2)
+
+/*
+ * Interleaved blocks : a block is split in 4 segments encoded as 4 bitstreams, preceded by a jump table
+ * (= encoded size of the first 3 bitstreams).
+ */
+#define HUFF_NB_STREAMS           4
+#define HUFF_JUMP_TABLE_SIZE      ((HUFF_NB_STREAMS - 1) * sizeof(uint32_t))
+
+/*
+ * Maximum size of an encoded block.
+ */
+#define huff_block_bound(len)     (HUFF_LENGTHS_MAX_SIZE + HUFF_JUMP_TABLE_SIZE \
+                                   + ((len) * HUFF_MAX_CODE_LENGTH + 7) / 8 + HUFF_NB_STREAMS * 8)
 
 #define huffman_leaf(node)        ((node)->left == NULL && (node)->right == NULL)
 
@@ -25,25 +64,39 @@
  * Huffman node.
  */
 struct huff_node_t {
-  unsigned char item;
-  int freq;
-  char huff_code[NB_CHARACTERS / 8];
+  int item;
+  size_t freq;
   struct huff_node_t *left;
   struct huff_node_t *right;
 };
 
+/*
+ * Huffman block (= independent chunk of input, encoded with its own code lengths).
+ */
+struct huff_block_t {
+  unsigned char *src;
+  size_t src_len;
+  unsigned char *dst;
+  size_t dst_len;
+  int flags;
+  int ret;
+};
+
 /*
  * Compare 2 huffman nodes.
  */
 static int huff_node_compare(const void *h1, const void *h2)
 {
-  return ((struct huff_node_t *) h1)->freq - ((struct huff_node_t *) h2)->freq;
+  size_t f1 = ((struct huff_node_t *) h1)->freq;
+  size_t f2 = ((struct huff_node_t *) h2)->freq;
+
+  return (f1 > f2) - (f1 < f2);
 }
 
 /*
  * Create a new huffman node.
  */
-static struct huff_node_t *huff_node_create(unsigned char item, int freq)
+static struct huff_node_t *huff_node_create(int item, size_t freq)
 {
   struct huff_node_t *node;
 
@@ -52,7 +105,6 @@ static struct huff_node_t *huff_node_create(unsigned char item, int freq)
   node->freq = freq;
   node->left = NULL;
   node->right = NULL;
-  memset(node->huff_code, 0, sizeof(node->huff_code));
 
   return node;
 }
@@ -60,9 +112,9 @@ static struct huff_node_t *huff_node_create(unsigned char item, int freq)
 /*
  * Build huffman tree.
  */
-static struct huff_node_t *huffman_tree(int *freq, size_t nb_characters)
+static struct huff_node_t *huffman_tree(size_t *freq, size_t nb_characters)
 {
-  struct huff_node_t *left, *right, *top, *node;
+  struct huff_node_t *left, *right, *top, *node, *root;
   struct heap_t *heap;
   size_t i;
 
@@ -103,135 +155,402 @@ static struct huff_node_t *huffman_tree(int *freq, size_t nb_characters)
     heap_insert(heap, top);
   }
 
-  return heap_min(heap);
+  /* extract root */
+  root = heap_min(heap);
+  heap_free(heap);
+
+  return root;
 }
 
 /*
- * Build huffman codes.
+ * Free a huffman tree.
  */
-static void huffman_tree_build_codes(struct huff_node_t *root, char *code, int top)
+static void huffman_tree_free(struct huff_node_t *root)
 {
-  /* build huffman code on left (encode with a zero) */
-  if (root->left) {
-    code[top] = '0';
-    huffman_tree_build_codes(root->left, code, top + 1);
-  }
+  struct huff_node_t *left, *right;
 
-  /* build huffman code on right (encode with a one) */
-  if (root->right) {
-    code[top] = '1';
-    huffman_tree_build_codes(root->right, code, top + 1);
-  }
+  if (!root)
+    return;
 
-  /* leaf : create code */
-  if (huffman_leaf(root))
-    strncpy(root->huff_code, code, top);
+  /* free root */
+  left = root->left;
+  right = root->right;
+  free(root);
+
+  /* free children */
+  huffman_tree_free(left);
+  huffman_tree_free(right);
 }
 
 /*
- * Extract huffman nodes from a tree.
+ * Extract code lengths (= depth of leaves) from a tree.
  */
-static void huffman_tree_extract_nodes(struct huff_node_t *root, struct huff_node_t **nodes)
+static void huffman_tree_extract_lengths(struct huff_node_t *root, int depth, int *lengths)
 {
   if (!root)
     return;
 
-  if (root->left)
-    huffman_tree_extract_nodes(root->left, nodes);
+  if (huffman_leaf(root)) {
+    lengths[root->item] = depth;
+    return;
+  }
 
-  if (root->right)
-    huffman_tree_extract_nodes(root->right, nodes);
+  huffman_tree_extract_lengths(root->left, depth + 1, lengths);
+  huffman_tree_extract_lengths(root->right, depth + 1, lengths);
+}
 
-  if (huffman_leaf(root))
-    nodes[(int) root->item] = root;
+/*
+ * Extract binary codes (as integers) and code lengths from a tree.
+ */
+static int huffman_tree_extract_codes(struct huff_node_t *root, uint32_t code, int depth, uint32_t *codes,
+                                      int *lengths)
+{
+  if (!root)
+    return 0;
+
+  /* leaf : store code */
+  if (huffman_leaf(root)) {
+    codes[root->item] = code;
+    lengths[root->item] = depth;
+    return 0;
+  }
+
+  /* code too long */
+  if (depth >= HUFF_MAX_CODE_BITS)
+    return -1;
+
+  if (huffman_tree_extract_codes(root->left, code << 1, depth + 1, codes, lengths))
+    return -1;
+
+  return huffman_tree_extract_codes(root->right, (code << 1) | 1, depth + 1, codes, lengths);
 }
 
 /*
- * Free a huffman tree.
+ * Build a decoding table from binary codes.
  */
-static void huffman_tree_free(struct huff_node_t *root)
+int huffman_table_build(struct huff_table_t *table, uint32_t *codes, int *lengths, size_t nb_symbols)
 {
-  struct huff_node_t *left, *right;
+  unsigned char sub_bits[1 << HUFF_TABLE_BITS];
+  uint32_t offsets[1 << HUFF_TABLE_BITS];
+  size_t i, j, size, prefix, first, n;
+  uint64_t kraft;
+  int len;
+
+  /* check lengths (over-subscribed codes = corrupted header) */
+  for (i = 0, kraft = 0; i < nb_symbols; i++) {
+    if (lengths[i] > HUFF_MAX_CODE_BITS)
+      return -1;
+    if (lengths[i] > 0)
+      kraft += (uint64_t) 1 << (HUFF_MAX_CODE_BITS - lengths[i]);
+  }
+  if (kraft > (uint64_t) 1 << HUFF_MAX_CODE_BITS)
+    return -1;
+
+  /* compute subtables size (= longest code sharing a prefix) */
+  memset(sub_bits, 0, sizeof(sub_bits));
+  for (i = 0; i < nb_symbols; i++) {
+    if (lengths[i] > HUFF_TABLE_BITS) {
+      prefix = codes[i] >> (lengths[i] - HUFF_TABLE_BITS);
+      if (lengths[i] - HUFF_TABLE_BITS > sub_bits[prefix])
+        sub_bits[prefix] = lengths[i] - HUFF_TABLE_BITS;
+    }
+  }
+
+  /* place subtables after primary table */
+  for (i = 0, size = 1 << HUFF_TABLE_BITS; i < (1 << HUFF_TABLE_BITS); i++) {
+    offsets[i] = size;
+    if (sub_bits[i])
+      size += (size_t) 1 << sub_bits[i];
+  }
+
+  /* table too large */
+  if (size > huff_link_offset(~0U))
+    return -1;
+
+  /* allocate table (unused entries decode as zero length) */
+  table->size = size;
+  table->max_len = 0;
+  table->entries = (uint32_t *) xmalloc(sizeof(uint32_t) * size);
+  memset(table->entries, 0, sizeof(uint32_t) * size);
+
+  /* set links */
+  for (i = 0; i < (1 << HUFF_TABLE_BITS); i++)
+    if (sub_bits[i])
+      table->entries[i] = huff_link(offsets[i], sub_bits[i]);
+
+  /* fill entries : a code of length len fills all entries starting with it */
+  for (i = 0; i < nb_symbols; i++) {
+    len = lengths[i];
+    if (len <= 0)
+      continue;
+
+    if (len > table->max_len)
+      table->max_len = len;
+
+    if (len <= HUFF_TABLE_BITS) {
+      first = (size_t) codes[i] << (HUFF_TABLE_BITS - len);
+      n = (size_t) 1 << (HUFF_TABLE_BITS - len);
+    } else {
+      prefix = codes[i] >> (len - HUFF_TABLE_BITS);
+      first = codes[i] & (((uint32_t) 1 << (len - HUFF_TABLE_BITS)) - 1);
+      first = offsets[prefix] + (first << (sub_bits[prefix] - (len - HUFF_TABLE_BITS)));
+      n = (size_t) 1 << (sub_bits[prefix] - (len - HUFF_TABLE_BITS));
+    }
+
+    for (j = 0; j < n; j++)
+      table->entries[first + j] = huff_entry(i, len);
+  }
+
+  return 0;
+}
+
+/*
+ * Limit code lengths to max_length bits.
+ * Longer codes are cut to max_length, then the Kraft inequality (sum of 2^-length <= 1) is restored
+ * by lengthening the longest codes below max_length (least frequent first). Remaining room is finally
+ * given back to the most frequent characters.
+ */
+static void huffman_limit_lengths(size_t *freq, int *lengths, size_t nb_characters, int max_length)
+{
+  size_t i, best, kraft, max_kraft;
+
+  /* compute kraft sum (in units of 2^-max_length) with cut lengths */
+  max_kraft = (size_t) 1 << max_length;
+  for (i = 0, kraft = 0; i < nb_characters; i++) {
+    if (lengths[i] > max_length)
+      lengths[i] = max_length;
+    if (lengths[i])
+      kraft += (size_t) 1 << (max_length - lengths[i]);
+  }
+
+  /* lengthen codes until sum fits */
+  while (kraft > max_kraft) {
+    for (i = 0, best = nb_characters; i < nb_characters; i++) {
+      if (!lengths[i] || lengths[i] >= max_length)
+        continue;
 
+      if (best == nb_characters || lengths[i] > lengths[best]
+          || (lengths[i] == lengths[best] && freq[i] < freq[best]))
+        best = i;
+    }
+
+    lengths[best]++;
+    kraft -= (size_t) 1 << (max_length - lengths[best]);
+  }
+
+  /* shorten most frequent codes while sum still fits */
+  for (;;) {
+    for (i = 0, best = nb_characters; i < nb_characters; i++) {
+      if (lengths[i] <= 1 || kraft + ((size_t) 1 << (max_length - lengths[i])) > max_kraft)
+        continue;
+
+      if (best == nb_characters || freq[i] > freq[best])
+        best = i;
+    }
+
+    if (best == nb_characters)
+      break;
+
+    kraft += (size_t) 1 << (max_length - lengths[best]);
+    lengths[best]--;
+  }
+}
+
+/*
+ * Compute code lengths of symbols from their frequencies.
+ */
+int huffman_build_lengths(size_t *freq, int *lengths, size_t nb_symbols, int max_length)
+{
+  struct huff_node_t *root;
+
+  /* build huffman tree */
+  memset(lengths, 0, sizeof(int) * nb_symbols);
+  root = huffman_tree(freq, nb_symbols);
   if (!root)
-    return;
+    return -1;
 
-  /* free root */
-  left = root->left;
-  right = root->right;
-  free(root);
+  /* extract lengths */
+  huffman_tree_extract_lengths(root, 0, lengths);
 
-  /* free children */
-  huffman_tree_free(left);
-  huffman_tree_free(right);
+  /* only one symbol : use a 1 bit code */
+  if (huffman_leaf(root))
+    lengths[root->item] = 1;
+
+  /* free huffman tree */
+  huffman_tree_free(root);
+
+  /* limit lengths */
+  huffman_limit_lengths(freq, lengths, nb_symbols, max_length);
+
+  return 0;
+}
+
+/*
+ * Build canonical codes from code lengths : codes are assigned in increasing order of (length, symbol).
+ */
+void huffman_canonical_codes(int *lengths, uint32_t *codes, size_t nb_symbols)
+{
+  uint32_t count[HUFF_MAX_CODE_LENGTH + 1], next[HUFF_MAX_CODE_LENGTH + 1], code;
+  size_t i;
+  int len;
+
+  /* count codes of each length */
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < nb_symbols; i++)
+    count[lengths[i]]++;
+
+  /* compute first code of each length */
+  count[0] = 0;
+  for (len = 1, code = 0; len <= HUFF_MAX_CODE_LENGTH; len++) {
+    code = (code + count[len - 1]) << 1;
+    next[len] = code;
+  }
+
+  /* assign codes */
+  for (i = 0; i < nb_symbols; i++)
+    codes[i] = lengths[i] ? next[lengths[i]]++ : 0;
 }
 
 /*
  * Compute frequencies.
  */
-static void huffman_compute_frequencies(FILE *fp, int *freq, size_t nb_characters)
+static void huffman_compute_frequencies(struct stream_t *stream, size_t *freq, size_t nb_characters)
 {
-  unsigned char buf[BUF_SIZE];
-  size_t len, i;
+  unsigned char buf[IO_BUF_SIZE];
+  size_t len;
 
   /* reset frequencies */
-  memset(freq, 0, sizeof(int) * nb_characters);
+  memset(freq, 0, sizeof(size_t) * nb_characters);
+
+  /* memory input : count it at once */
+  if (!stream->fp) {
+    histogram_count(stream->buf, stream->len, freq);
+    return;
+  }
 
   /* read all file */
   while (1) {
-    len = fread(buf, 1, BUF_SIZE, fp);
+    len = stream_read(stream, buf, IO_BUF_SIZE);
     if (len <= 0)
       return;
 
     /* compute buffer */
-    for (i = 0; i < len; i++)
-      freq[(int) buf[i]]++;
+    histogram_count(buf, len, freq);
   }
 }
 
 /*
- * Write huffman header.
+ * Encode code lengths = range of used characters and their code lengths (2 per byte).
  */
-static void huffman_write_header(FILE *fp, struct huff_node_t **nodes, size_t nb_nodes)
+static size_t huffman_write_lengths(unsigned char *buf, int *lengths, size_t nb_characters)
 {
+  unsigned char first, last;
   size_t i, n;
 
-  /* compute number of nodes */
-  for (i = 0, n = 0; i < nb_nodes; i++)
-    if (nodes[i])
-      n++;
+  /* find range of used characters */
+  for (first = 0; !lengths[first]; first++);
+  for (last = nb_characters - 1; !lengths[last]; last--);
+  buf[0] = first;
+  buf[1] = last;
+
+  /* write code lengths */
+  for (i = first, n = 2; i <= last; i += 2) {
+    buf[n] = lengths[i] << 4;
+    if (i + 1 <= last)
+      buf[n] |= lengths[i + 1];
+    n++;
+  }
 
-  /* write number of nodes */
-  fwrite(&n, sizeof(int), 1, fp);
+  return n;
+}
 
-  /* write dictionnary */
-  for (i = 0; i < nb_nodes; i++) {
-    if (nodes[i]) {
-      fwrite(&nodes[i]->item, sizeof(char), 1, fp);
-      fwrite(&nodes[i]->freq, sizeof(int), 1, fp);
-    }
+/*
+ * Decode code lengths. Returns number of bytes read or -1 on error.
+ */
+static int huffman_read_lengths(const unsigned char *buf, size_t len, int *lengths, size_t nb_characters)
+{
+  size_t i, n;
+
+  /* reset lengths */
+  memset(lengths, 0, sizeof(int) * nb_characters);
+
+  /* read range of used characters */
+  if (len < 2 || buf[0] > buf[1] || len < 2 + (size_t) (buf[1] - buf[0] + 2) / 2)
+    return -1;
+
+  /* read code lengths */
+  for (i = buf[0], n = 2; i <= buf[1]; i += 2, n++) {
+    lengths[i] = buf[n] >> 4;
+    if (i + 1 <= buf[1])
+      lengths[i + 1] = buf[n] & 0x0F;
   }
+
+  return n;
 }
 
 /*
- * Read huffman header.
+ * Write huffman header = magic, number of characters and code lengths.
  */
-static void huffman_read_header(FILE *fp, int *freq, size_t nb_characters)
+static void huffman_write_header(struct stream_t *stream, int *lengths, size_t nb_characters, uint64_t nb_items)
+{
+  unsigned char buf[HUFF_LENGTHS_MAX_SIZE];
+
+  /* write magic and number of characters */
+  stream_write(stream, HUFFMAN_MAGIC, HUFFMAN_MAGIC_SIZE);
+  stream_write(stream, &nb_items, sizeof(uint64_t));
+
+  /* write code lengths (empty file : no code) */
+  if (nb_items)
+    stream_write(stream, buf, huffman_write_lengths(buf, lengths, nb_characters));
+}
+
+/*
+ * Read huffman header (magic has already been read).
+ */
+static int huffman_read_header(struct stream_t *stream, int *lengths, size_t nb_characters, uint64_t *nb_items)
+{
+  unsigned char buf[HUFF_LENGTHS_MAX_SIZE];
+  size_t len;
+
+  /* reset lengths */
+  memset(lengths, 0, sizeof(int) * nb_characters);
+
+  /* read number of characters */
+  if (stream_read(stream, nb_items, sizeof(uint64_t)) != sizeof(uint64_t))
+    return -1;
+
+  /* empty file */
+  if (!*nb_items)
+    return 0;
+
+  /* read range of used characters */
+  if (stream_read(stream, buf, 2) != 2 || buf[0] > buf[1])
+    return -1;
+
+  /* read code lengths */
+  len = (buf[1] - buf[0] + 2) / 2;
+  if (stream_read(stream, buf + 2, len) != len)
+    return -1;
+
+  return huffman_read_lengths(buf, len + 2, lengths, nb_characters) < 0 ? -1 : 0;
+}
+
+/*
+ * Read old huffman header = every letter with its frequency (number of nodes has already been read).
+ */
+static void huffman_read_header_freq(struct stream_t *stream, size_t *freq, size_t nb_characters, int nb_nodes)
 {
-  int nb_nodes, i, f;
   unsigned char c;
+  int i, f;
 
   /* reset frequencies */
-  memset(freq, 0, sizeof(int) * nb_characters);
-
-  /* read number of nodes */
-  fread(&nb_nodes, sizeof(int), 1, fp);
+  memset(freq, 0, sizeof(size_t) * nb_characters);
 
   /* read header */
   for (i = 0; i < nb_nodes; i++) {
     /* read item and its frequency */
-    fread(&c, sizeof(char), 1, fp);
-    fread(&f, sizeof(int), 1, fp);
+    stream_read(stream, &c, sizeof(char));
+    stream_read(stream, &f, sizeof(int));
 
     /* store frequency */
     freq[c] = f;
@@ -239,227 +558,862 @@ static void huffman_read_header(FILE *fp, int *freq, size_t nb_characters)
 }
 
 /*
- * Write a huffman buffer to output file (input buffer must be converted to binary buffer).
+ * Encode a buffer with huffman codes.
  */
-static void huffman_write_buffer(FILE *fp, char *buf, size_t len)
+static inline void huffman_encode_items(struct bit_writer_t *bw, const unsigned char *buf, size_t len,
+                                        uint32_t *codes, int *lengths)
 {
-  unsigned char c;
-  size_t i, j, n;
-
-  if (len <= 0)
-    return;
-
-  for (i = 0; i < len; i += 8) {
-    c = 0;
-
-    /* number of bits */
-    n = 8;
-    if (i + 8 > len)
-      n = len - i;
-
-    /* convert string huffman code to binary */
-    for (j = 0; j < n; j++)
-      if (buf[i + j] == '1')
-        c |= 1 << (8 - j - 1);
+  size_t i;
 
-    /* write binary buffer */
-    fwrite(&c, sizeof(char), 1, fp);
-  }
+  for (i = 0; i < len; i++)
+    bit_writer_put(bw, codes[buf[i]], lengths[buf[i]]);
 }
 
 /*
- * Encode file content with huffman codes.
+ * Encode input content with huffman codes.
  */
-static void huffman_write_content(FILE *fp_input, FILE *fp_output, struct huff_node_t **nodes)
+static void huffman_write_content(struct stream_t *input, struct stream_t *output, uint32_t *codes, int *lengths)
 {
-  unsigned char buf_input[BUF_SIZE];
-  char buf_output[BUF_SIZE];
-  struct huff_node_t *node;
-  size_t len, i, j, k;
+  unsigned char buf_input[IO_BUF_SIZE], buf_output[IO_BUF_SIZE];
+  struct bit_writer_t bw;
+  size_t len;
+
+  /* init bit writer */
+  bit_writer_init(&bw, output, buf_output, IO_BUF_SIZE);
+
+  /* memory input : encode it at once */
+  if (!input->fp) {
+    huffman_encode_items(&bw, input->buf, input->len, codes, lengths);
+    bit_writer_flush(&bw);
+    return;
+  }
 
   /* rewind input file */
-  rewind(fp_input);
+  stream_seek(input, 0);
 
   /* read all file */
-  for (k = 0;;) {
+  for (;;) {
     /* read input file */
-    len = fread(buf_input, 1, BUF_SIZE, fp_input);
+    len = stream_read(input, buf_input, IO_BUF_SIZE);
     if (len <= 0)
       break;
 
     /* convert characters to huffman codes */
-    for (i = 0; i < len; i++) {
-      /* get huffman node */
-      node = nodes[(int) buf_input[i]];
-
-      /* store huffman code in output buffer */
-      for (j = 0; node->huff_code[j]; j++) {
-        buf_output[k++] = node->huff_code[j];
-
-        /* output buffer full : write it */
-        if (k >= BUF_SIZE) {
-          huffman_write_buffer(fp_output, buf_output, k);
-          k = 0;
-        }
-      }
-    }
+    huffman_encode_items(&bw, buf_input, len, codes, lengths);
   }
 
-  /* write last buffer */
-  huffman_write_buffer(fp_output, buf_output, k);
+  /* write last bits */
+  bit_writer_flush(&bw);
 }
 
 /*
- * Decode huffman file content.
+ * Decode next character.
  */
-static void huffman_read_content(FILE *fp_input, FILE *fp_output, struct huff_node_t *root)
+static inline unsigned char huffman_decode_item(struct bit_reader_t *br, struct huff_table_t *table)
 {
-  unsigned char buf_input[BUF_SIZE];
-  unsigned char buf_output[BUF_SIZE];
-  struct huff_node_t *node;
-  size_t len, i, j, k;
-  int v;
+  return huffman_decode_symbol(br, table);
+}
 
-  for (node = root, k = 0;;) {
-    /* read input file */
-    len = fread(buf_input, 1, BUF_SIZE, fp_input);
-    if (len <= 0)
-      break;
+/*
+ * Decode nb_items characters.
+ */
+static inline void huffman_decode_items(struct bit_reader_t *br, struct huff_table_t *table, unsigned char *buf,
+                                        size_t nb_items)
+{
+  size_t i;
 
-    /* decode each character */
-    for (i = 0; i < len; i++) {
-      /* extract each bit */
-      for (j = 0; j < 8; j++) {
-        v = (buf_input[i] >> (8 - j - 1)) & 1;
-
-        /* walk through the tree */
-        if (v)
-          node = node->right;
-        else
-          node = node->left;
-
-        /* leaf : store code */
-        if (huffman_leaf(node)) {
-          buf_output[k++] = node->item;
-          node = root;
-
-          /* output buffer full : write it */
-          if (k >= BUF_SIZE) {
-            fwrite(buf_output, 1, k, fp_output);
-            k = 0;
-          }
-        }
-      }
-    }
+  for (i = 0; i < nb_items; i++)
+    buf[i] = huffman_decode_item(br, table);
+}
+
+/*
+ * Decode 4 interleaved bitstreams : every iteration advances 4 independent bit readers.
+ */
+static void huffman_decode_items_x4(struct bit_reader_t *br, struct huff_table_t *table, unsigned char *buf,
+                                    size_t segment_size, size_t nb_items)
+{
+  unsigned char *buf0 = buf, *buf1 = buf + segment_size, *buf2 = buf + 2 * segment_size;
+  unsigned char *buf3 = buf + 3 * segment_size;
+  size_t i, n;
+
+  /* last segment may be shorter */
+  n = nb_items - 3 * segment_size;
+
+  /* decode 4 segments */
+  for (i = 0; i < n; i++) {
+    buf0[i] = huffman_decode_item(&br[0], table);
+    buf1[i] = huffman_decode_item(&br[1], table);
+    buf2[i] = huffman_decode_item(&br[2], table);
+    buf3[i] = huffman_decode_item(&br[3], table);
   }
 
-  /* write last buffer */
-  if (k > 0)
-    fwrite(buf_output, 1, k, fp_output);
+  /* end of first 3 segments */
+  for (; i < segment_size; i++) {
+    buf0[i] = huffman_decode_item(&br[0], table);
+    buf1[i] = huffman_decode_item(&br[1], table);
+    buf2[i] = huffman_decode_item(&br[2], table);
+  }
 }
 
 /*
- * Huffman encoding of a file.
+ * Decode huffman content.
  */
-int huffman_encode(const char *input_file, const char *output_file)
+static void huffman_read_content(struct stream_t *input, struct stream_t *output, struct huff_table_t *table,
+                                 size_t nb_items)
 {
-  struct huff_node_t *root, *nodes[NB_CHARACTERS];
-  int freq[NB_CHARACTERS], ret;
-  FILE *fp_input, *fp_output;
-  char code[NB_CHARACTERS];
-  size_t i;
+  unsigned char buf_input[BIT_IO_BUF_SIZE], buf_output[IO_BUF_SIZE];
+  struct bit_reader_t br;
+  size_t n;
+
+  /* init bit reader (memory input is read in place) */
+  if (input->fp)
+    bit_reader_init(&br, input, buf_input, buf_input, 0);
+  else
+    bit_reader_init(&br, NULL, NULL, input->buf + input->pos, input->len - input->pos);
+
+  /* memory output : decode in place */
+  if (!output->fp && nb_items <= output->size - output->pos) {
+    huffman_decode_items(&br, table, output->buf + output->pos, nb_items);
+    output->pos += nb_items;
+    if (output->pos > output->len)
+      output->len = output->pos;
+    return;
+  }
 
-  /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
+  /* decode and write output buffers */
+  for (; nb_items > 0 && !stream_error(output); nb_items -= n) {
+    n = nb_items < IO_BUF_SIZE ? nb_items : IO_BUF_SIZE;
+    huffman_decode_items(&br, table, buf_output, n);
+    stream_write(output, buf_output, n);
+  }
+}
 
-  /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
+/*
+ * Get segment size of an interleaved block (the last segment holds the remaining characters).
+ * Blocks too small to be split are encoded as a single bitstream.
+ */
+static inline size_t huffman_segment_size(size_t len)
+{
+  return len < HUFF_NB_STREAMS * HUFF_NB_STREAMS ? 0 : (len + HUFF_NB_STREAMS - 1) / HUFF_NB_STREAMS;
+}
+
+/*
+ * Encode a block in memory (dst must hold huff_block_bound(len) bytes).
+ */
+static int huffman_encode_block(const unsigned char *src, size_t len, unsigned char *dst, size_t *dst_len,
+                                int flags)
+{
+  int lengths[NB_CHARACTERS], ret, i;
+  size_t freq[NB_CHARACTERS], n, seg;
+  uint32_t codes[NB_CHARACTERS], w;
+  struct bit_writer_t bw;
+
+  /* empty block */
+  *dst_len = 0;
+  if (!len)
+    return 0;
+
+  /* compute frequencies */
+  memset(freq, 0, sizeof(freq));
+  histogram_count(src, len, freq);
+
+  /* build codes */
+  ret = huffman_build_lengths(freq, lengths, NB_CHARACTERS, HUFF_MAX_CODE_LENGTH);
+  if (ret)
     return ret;
+  huffman_canonical_codes(lengths, codes, NB_CHARACTERS);
+
+  /* write code lengths */
+  n = huffman_write_lengths(dst, lengths, NB_CHARACTERS);
+
+  /* single bitstream */
+  seg = huffman_segment_size(len);
+  if (!(flags & HUFFMAN_4_STREAMS) || !seg) {
+    bit_writer_init(&bw, NULL, dst + n, huff_block_bound(len) - n);
+    huffman_encode_items(&bw, src, len, codes, lengths);
+    bit_writer_flush(&bw);
+    *dst_len = n + bw.pos;
+    return 0;
   }
 
-  /* compute frequencies */
-  huffman_compute_frequencies(fp_input, freq, NB_CHARACTERS);
+  /* interleaved bitstreams : write segments after jump table */
+  *dst_len = n + HUFF_JUMP_TABLE_SIZE;
+  for (i = 0; i < HUFF_NB_STREAMS; i++) {
+    bit_writer_init(&bw, NULL, dst + *dst_len, huff_block_bound(len) - *dst_len);
+    huffman_encode_items(&bw, src + i * seg, i < HUFF_NB_STREAMS - 1 ? seg : len - i * seg, codes, lengths);
+    bit_writer_flush(&bw);
+    *dst_len += bw.pos;
+
+    /* store bitstream size in jump table */
+    if (i < HUFF_NB_STREAMS - 1) {
+      w = bw.pos;
+      memcpy(dst + n + i * sizeof(uint32_t), &w, sizeof(uint32_t));
+    }
+  }
 
-  /* build huffman tree */
-  root = huffman_tree(freq, NB_CHARACTERS);
-  if (!root) {
-    fclose(fp_input);
-    fclose(fp_output);
+  return 0;
+}
+
+/*
+ * Decode a block in memory.
+ */
+static int huffman_decode_block(const unsigned char *src, size_t len, unsigned char *dst, size_t nb_items, int flags)
+{
+  struct bit_reader_t br[HUFF_NB_STREAMS];
+  int lengths[NB_CHARACTERS], n, ret, i;
+  uint32_t codes[NB_CHARACTERS], w;
+  struct huff_table_t table;
+  size_t seg, pos;
+
+  /* empty block */
+  if (!nb_items)
+    return 0;
+
+  /* read code lengths */
+  n = huffman_read_lengths(src, len, lengths, NB_CHARACTERS);
+  if (n < 0)
     return -1;
+
+  /* build decoding table */
+  huffman_canonical_codes(lengths, codes, NB_CHARACTERS);
+  ret = huffman_table_build(&table, codes, lengths, NB_CHARACTERS);
+  if (ret)
+    return ret;
+
+  /* single bitstream */
+  seg = huffman_segment_size(nb_items);
+  if (!(flags & HUFFMAN_4_STREAMS) || !seg) {
+    bit_reader_init(&br[0], NULL, NULL, src + n, len - n);
+    huffman_decode_items(&br[0], &table, dst, nb_items);
+    goto out;
+  }
+
+  /* interleaved bitstreams : use jump table to find every bitstream */
+  ret = -1;
+  if (len < n + HUFF_JUMP_TABLE_SIZE)
+    goto out;
+  for (i = 0, pos = n + HUFF_JUMP_TABLE_SIZE; i < HUFF_NB_STREAMS; i++, pos += w) {
+    if (i < HUFF_NB_STREAMS - 1)
+      memcpy(&w, src + n + i * sizeof(uint32_t), sizeof(uint32_t));
+    else
+      w = len - pos;
+
+    if (w > len - pos)
+      goto out;
+
+    bit_reader_init(&br[i], NULL, NULL, src + pos, w);
   }
 
-  /* build huffman codes */
-  huffman_tree_build_codes(root, code, 0);
+  huffman_decode_items_x4(br, &table, dst, seg, nb_items);
+  ret = 0;
+out:
+  free(table.entries);
+  return ret;
+}
+
+/*
+ * Block encoding job.
+ */
+static void huffman_encode_block_job(void *arg)
+{
+  struct huff_block_t *block = (struct huff_block_t *) arg;
+
+  block->ret = huffman_encode_block(block->src, block->src_len, block->dst, &block->dst_len, block->flags);
+}
 
-  /* extract nodes from tree */
-  for (i = 0; i < NB_CHARACTERS; i++)
-    nodes[i] = NULL;
-  huffman_tree_extract_nodes(root, nodes);
+/*
+ * Block decoding job.
+ */
+static void huffman_decode_block_job(void *arg)
+{
+  struct huff_block_t *block = (struct huff_block_t *) arg;
+
+  block->ret = huffman_decode_block(block->src, block->src_len, block->dst, block->dst_len, block->flags);
+}
+
+/*
+ * Huffman encoding (input is read twice : to compute frequencies and to encode it).
+ */
+static int huffman_encode_data(struct stream_t *input, struct stream_t *output)
+{
+  size_t freq[NB_CHARACTERS], nb_items, i;
+  int lengths[NB_CHARACTERS], ret;
+  uint32_t codes[NB_CHARACTERS];
+
+  /* compute frequencies */
+  huffman_compute_frequencies(input, freq, NB_CHARACTERS);
+  for (i = 0, nb_items = 0; i < NB_CHARACTERS; i++)
+    nb_items += freq[i];
+
+  /* empty input : write header only */
+  if (!nb_items) {
+    memset(lengths, 0, sizeof(lengths));
+    huffman_write_header(output, lengths, NB_CHARACTERS, 0);
+    return stream_error(output) ? -1 : 0;
+  }
+
+  /* build length limited code lengths */
+  ret = huffman_build_lengths(freq, lengths, NB_CHARACTERS, HUFF_MAX_CODE_LENGTH);
+  if (ret)
+    return ret;
+
+  /* build canonical codes */
+  huffman_canonical_codes(lengths, codes, NB_CHARACTERS);
 
   /*  write header */
-  huffman_write_header(fp_output, nodes, NB_CHARACTERS);
+  huffman_write_header(output, lengths, NB_CHARACTERS, nb_items);
 
   /* write codes */
-  huffman_write_content(fp_input, fp_output, nodes);
+  huffman_write_content(input, output, codes, lengths);
 
-  /* free huffman tree */
-  huffman_tree_free(root);
+  return stream_error(output) ? -1 : 0;
+}
+
+/*
+ * Huffman encoding of a file.
+ */
+int huffman_encode(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* encode file */
+  ret = huffman_encode_data(&input, &output);
 
   /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
 
-  return 0;
+  return ret;
 }
 
 /*
- * Huffman decoding of a file.
+ * Maximum size of a huffman encoded buffer.
  */
-int huffman_decode(const char *input_file, const char *output_file)
+size_t huffman_encode_bound(size_t len)
 {
-  FILE *fp_input, *fp_output;
-  struct huff_node_t *root;
-  int freq[NB_CHARACTERS];
+  return HUFFMAN_MAGIC_SIZE + sizeof(uint64_t) + HUFF_LENGTHS_MAX_SIZE + (len * HUFF_MAX_CODE_LENGTH + 7) / 8;
+}
+
+/*
+ * Huffman encoding of a buffer (dst_size = capacity of dst, huffman_encode_bound(src_len) is always enough).
+ */
+int huffman_encode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = huffman_encode_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
+}
+
+/*
+ * Huffman encoding of a file, by independent blocks encoded in parallel.
+ * Output = magic, flags, number of characters, block size, number of blocks, block index (= encoded size of
+ * every block) and encoded blocks.
+ */
+int huffman_encode_blocks(const char *input_file, const char *output_file, size_t block_size, int nb_threads,
+                          int flags)
+{
+  unsigned char *buf_input = NULL, *buf_output = NULL;
+  uint32_t *index = NULL, nb_blocks, block_size32;
+  struct huff_block_t *blocks = NULL;
+  struct thread_pool_t *pool = NULL;
+  struct stream_t input, output;
+  size_t i, n, batch, bound;
+  uint64_t nb_items;
+  off_t size, index_pos;
   int ret;
 
+  /* check block size */
+  if (!block_size || block_size > HUFFMAN_MAX_BLOCK_SIZE)
+    return -1;
+
   /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
 
   /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
     return ret;
   }
 
+  /* get input size */
+  ret = -1;
+  size = stream_size(&input);
+  if (size < 0)
+    goto out;
+
+  /* number of blocks */
+  nb_items = size;
+  if ((nb_items + block_size - 1) / block_size > UINT32_MAX)
+    goto out;
+  nb_blocks = (nb_items + block_size - 1) / block_size;
+  block_size32 = block_size;
+
+  /* write header */
+  stream_write(&output, HUFFMAN_BLOCKS_MAGIC, HUFFMAN_MAGIC_SIZE);
+  stream_putc(&output, flags);
+  stream_write(&output, &nb_items, sizeof(uint64_t));
+  stream_write(&output, &block_size32, sizeof(uint32_t));
+  stream_write(&output, &nb_blocks, sizeof(uint32_t));
+
+  /* write temporary block index */
+  index_pos = stream_tell(&output);
+  index = (uint32_t *) xmalloc(sizeof(uint32_t) * (nb_blocks + 1));
+  memset(index, 0, sizeof(uint32_t) * (nb_blocks + 1));
+  stream_write(&output, index, sizeof(uint32_t) * nb_blocks);
+
+  /* create thread pool */
+  pool = thread_pool_create(nb_threads);
+  if (!pool)
+    goto out;
+
+  /* allocate a batch of blocks (one per thread) */
+  batch = pool->nb_threads;
+  bound = huff_block_bound(block_size);
+  blocks = (struct huff_block_t *) xmalloc(sizeof(struct huff_block_t) * batch);
+  buf_output = (unsigned char *) xmalloc(bound * batch);
+  if (input.fp)
+    buf_input = (unsigned char *) xmalloc(block_size * batch);
+
+  for (i = 0; i < nb_blocks; i += n) {
+    /* read a batch of blocks (memory input is encoded in place) */
+    for (n = 0; n < batch && i + n < nb_blocks; n++) {
+      if (input.fp) {
+        blocks[n].src = buf_input + n * block_size;
+        blocks[n].src_len = stream_read(&input, blocks[n].src, block_size);
+      } else {
+        blocks[n].src = input.buf + input.pos;
+        blocks[n].src_len = input.len - input.pos < block_size ? input.len - input.pos : block_size;
+        input.pos += blocks[n].src_len;
+      }
+
+      blocks[n].dst = buf_output + n * bound;
+      blocks[n].flags = flags;
+    }
+
+    /* encode blocks */
+    for (n = 0; n < batch && i + n < nb_blocks; n++)
+      thread_pool_submit(pool, huffman_encode_block_job, &blocks[n]);
+    thread_pool_wait(pool);
+
+    /* write blocks */
+    for (n = 0; n < batch && i + n < nb_blocks; n++) {
+      if (blocks[n].ret)
+        goto out;
+
+      stream_write(&output, blocks[n].dst, blocks[n].dst_len);
+      index[i + n] = blocks[n].dst_len;
+    }
+  }
+
+  /* write final block index */
+  if (stream_seek(&output, index_pos) != 0)
+    goto out;
+  stream_write(&output, index, sizeof(uint32_t) * nb_blocks);
+
+  ret = 0;
+out:
+  /* free thread pool and buffers */
+  thread_pool_free(pool);
+  xfree(blocks);
+  xfree(buf_input);
+  xfree(buf_output);
+  xfree(index);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * Huffman encoding of a stream in a single pass (input doesn't need to be seekable).
+ * Input is read by blocks, and every block is written as soon as it is encoded.
+ * Output = magic, flags, block size and blocks (number of characters, encoded size and encoded block), until
+ * an empty block.
+ */
+int huffman_encode_stream(FILE *fp_input, FILE *fp_output, size_t block_size, int flags)
+{
+  unsigned char *buf_input, *buf_output;
+  uint32_t block_size32, len, dst_len;
+  size_t n;
+  int ret;
+
+  /* check block size */
+  if (!block_size || block_size > HUFFMAN_MAX_BLOCK_SIZE)
+    return -1;
+
+  /* allocate buffers */
+  buf_input = (unsigned char *) xmalloc(block_size);
+  buf_output = (unsigned char *) xmalloc(huff_block_bound(block_size));
+
+  /* write header */
+  block_size32 = block_size;
+  fwrite(HUFFMAN_STREAM_MAGIC, 1, HUFFMAN_MAGIC_SIZE, fp_output);
+  fputc(flags, fp_output);
+  fwrite(&block_size32, sizeof(uint32_t), 1, fp_output);
+
+  for (;;) {
+    /* read next block */
+    len = fread(buf_input, 1, block_size, fp_input);
+
+    /* encode block */
+    ret = huffman_encode_block(buf_input, len, buf_output, &n, flags);
+    if (ret)
+      break;
+
+    /* write block (stop on write error, e.g. full disk or closed pipe) */
+    dst_len = n;
+    if (fwrite(&len, sizeof(uint32_t), 1, fp_output) != 1) {
+      ret = -1;
+      break;
+    }
+    if (!len)
+      break;
+    if (fwrite(&dst_len, sizeof(uint32_t), 1, fp_output) != 1
+        || fwrite(buf_output, 1, dst_len, fp_output) != dst_len) {
+      ret = -1;
+      break;
+    }
+  }
+
+  /* read or write error (buffered output is flushed to catch late write errors) */
+  if (!ret && (ferror(fp_input) || fflush(fp_output) != 0 || ferror(fp_output)))
+    ret = -1;
+
+  /* free buffers */
+  free(buf_input);
+  free(buf_output);
+
+  return ret;
+}
+
+/*
+ * Build decoding table from an old header (codes are built from the huffman tree).
+ */
+static int huffman_decode_table_freq(struct stream_t *stream, struct huff_table_t *table, int nb_nodes,
+                                     uint64_t *nb_items)
+{
+  int lengths[NB_CHARACTERS], ret;
+  uint32_t codes[NB_CHARACTERS];
+  size_t freq[NB_CHARACTERS], i;
+  struct huff_node_t *root;
+
   /* read header */
-  huffman_read_header(fp_input, freq, NB_CHARACTERS);
+  huffman_read_header_freq(stream, freq, NB_CHARACTERS, nb_nodes);
+
+  /* number of encoded characters = sum of frequencies */
+  for (i = 0, *nb_items = 0; i < NB_CHARACTERS; i++)
+    *nb_items += freq[i];
+
+  /* empty file */
+  if (!*nb_items)
+    return 0;
 
   /* build huffman tree */
   root = huffman_tree(freq, NB_CHARACTERS);
-  if (!root) {
+  if (!root)
     return -1;
-    fclose(fp_input);
-    fclose(fp_output);
-  }
 
-  /* decode file's content */
-  huffman_read_content(fp_input, fp_output, root);
+  /* extract codes (only one character : no code has been written, use an empty code) */
+  memset(lengths, 0, sizeof(lengths));
+  ret = huffman_tree_extract_codes(root, 0, 0, codes, lengths);
+  if (!ret && huffman_leaf(root)) {
+    table->size = 1 << HUFF_TABLE_BITS;
+    table->max_len = 0;
+    table->entries = (uint32_t *) xmalloc(sizeof(uint32_t) * table->size);
+    for (i = 0; i < table->size; i++)
+      table->entries[i] = huff_entry(root->item, 0);
+  } else if (!ret) {
+    ret = huffman_table_build(table, codes, lengths, NB_CHARACTERS);
+  }
 
   /* free huffman tree */
   huffman_tree_free(root);
 
+  return ret;
+}
+
+/*
+ * Decode a file made of independent blocks (magic has already been read).
+ */
+static int huffman_decode_blocks(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char *buf_input = NULL, *buf_output = NULL;
+  uint32_t *index = NULL, nb_blocks, block_size;
+  struct huff_block_t *blocks = NULL;
+  struct thread_pool_t *pool = NULL;
+  size_t i, n, batch, len;
+  uint64_t nb_items;
+  int ret = -1, flags;
+
+  /* read header */
+  if ((flags = stream_getc(input)) == EOF || stream_read(input, &nb_items, sizeof(uint64_t)) != sizeof(uint64_t)
+      || stream_read(input, &block_size, sizeof(uint32_t)) != sizeof(uint32_t)
+      || stream_read(input, &nb_blocks, sizeof(uint32_t)) != sizeof(uint32_t))
+    return -1;
+
+  /* check header */
+  if (!block_size || block_size > HUFFMAN_MAX_BLOCK_SIZE || nb_blocks != (nb_items + block_size - 1) / block_size)
+    return -1;
+
+  /* read block index (fails if header announces more blocks than input holds) */
+  index = (uint32_t *) stream_read_array(input, nb_blocks, sizeof(uint32_t));
+  if (!index)
+    goto out;
+
+  /* create thread pool */
+  pool = thread_pool_create(0);
+  if (!pool)
+    goto out;
+
+  /* allocate a batch of blocks (one per thread) */
+  batch = pool->nb_threads;
+  blocks = (struct huff_block_t *) xmalloc(sizeof(struct huff_block_t) * batch);
+  buf_input = (unsigned char *) xmalloc(huff_block_bound(block_size) * batch);
+  buf_output = (unsigned char *) xmalloc((size_t) block_size * batch);
+
+  for (i = 0; i < nb_blocks; i += n) {
+    /* read a batch of blocks */
+    for (n = 0, len = 0; n < batch && i + n < nb_blocks; n++) {
+      if (index[i + n] > huff_block_bound(block_size))
+        goto out;
+
+      blocks[n].src = buf_input + len;
+      blocks[n].src_len = index[i + n];
+      blocks[n].dst = buf_output + n * block_size;
+      blocks[n].flags = flags;
+      blocks[n].dst_len = i + n < nb_blocks - 1 ? block_size : nb_items - (uint64_t) (nb_blocks - 1) * block_size;
+      len += index[i + n];
+    }
+
+    if (stream_read(input, buf_input, len) != len)
+      goto out;
+
+    /* decode blocks */
+    for (n = 0; n < batch && i + n < nb_blocks; n++)
+      thread_pool_submit(pool, huffman_decode_block_job, &blocks[n]);
+    thread_pool_wait(pool);
+
+    /* write blocks */
+    for (n = 0; n < batch && i + n < nb_blocks; n++) {
+      if (blocks[n].ret)
+        goto out;
+
+      stream_write(output, blocks[n].dst, blocks[n].dst_len);
+    }
+
+    /* write error */
+    if (stream_error(output))
+      goto out;
+  }
+
+  ret = 0;
+out:
+  /* free thread pool and buffers */
+  thread_pool_free(pool);
+  xfree(blocks);
+  xfree(buf_input);
+  xfree(buf_output);
+  xfree(index);
+
+  return ret;
+}
+
+/*
+ * Decode a stream of blocks (magic has already been read).
+ */
+static int huffman_decode_stream_blocks(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char *buf_input = NULL, *buf_output = NULL;
+  uint32_t block_size, len, src_len;
+  int ret = -1, flags;
+
+  /* read header */
+  if ((flags = stream_getc(input)) == EOF || stream_read(input, &block_size, sizeof(uint32_t)) != sizeof(uint32_t))
+    return -1;
+
+  /* check block size */
+  if (!block_size || block_size > HUFFMAN_MAX_BLOCK_SIZE)
+    return -1;
+
+  /* allocate buffers */
+  buf_input = (unsigned char *) xmalloc(huff_block_bound(block_size));
+  buf_output = (unsigned char *) xmalloc(block_size);
+
+  for (;;) {
+    /* read number of characters (empty block = end of stream) */
+    if (stream_read(input, &len, sizeof(uint32_t)) != sizeof(uint32_t))
+      goto out;
+    if (!len)
+      break;
+
+    /* read encoded block */
+    if (len > block_size || stream_read(input, &src_len, sizeof(uint32_t)) != sizeof(uint32_t)
+        || src_len > huff_block_bound(block_size) || stream_read(input, buf_input, src_len) != src_len)
+      goto out;
+
+    /* decode block */
+    if (huffman_decode_block(buf_input, src_len, buf_output, len, flags))
+      goto out;
+
+    /* write block */
+    if (stream_write(output, buf_output, len) != len)
+      goto out;
+  }
+
+  ret = 0;
+out:
+  /* free buffers */
+  free(buf_input);
+  free(buf_output);
+
+  return ret;
+}
+
+/*
+ * Decode a single huffman stream = canonical or old header followed by content (magic has already been read).
+ */
+static int huffman_decode_single(struct stream_t *input, struct stream_t *output,
+                                 const unsigned char *magic)
+{
+  int lengths[NB_CHARACTERS], nb_nodes, ret;
+  uint32_t codes[NB_CHARACTERS];
+  struct huff_table_t table;
+  uint64_t nb_items;
+
+  /* build decoding table */
+  table.entries = NULL;
+  if (memcmp(magic, HUFFMAN_MAGIC, HUFFMAN_MAGIC_SIZE) == 0) {
+    ret = huffman_read_header(input, lengths, NB_CHARACTERS, &nb_items);
+    if (!ret && nb_items) {
+      huffman_canonical_codes(lengths, codes, NB_CHARACTERS);
+      ret = huffman_table_build(&table, codes, lengths, NB_CHARACTERS);
+    }
+  } else {
+    memcpy(&nb_nodes, magic, sizeof(int));
+    ret = huffman_decode_table_freq(input, &table, nb_nodes, &nb_items);
+  }
+
+  /* decode content */
+  if (!ret && nb_items)
+    huffman_read_content(input, output, &table, nb_items);
+
+  /* free decoding table */
+  xfree(table.entries);
+
+  return ret;
+}
+
+/*
+ * Huffman decoding (any format).
+ */
+static int huffman_decode_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char magic[HUFFMAN_MAGIC_SIZE];
+  int ret;
+
+  /* read magic */
+  if (stream_read(input, magic, HUFFMAN_MAGIC_SIZE) != HUFFMAN_MAGIC_SIZE)
+    return -1;
+
+  /* independent blocks */
+  if (memcmp(magic, HUFFMAN_BLOCKS_MAGIC, HUFFMAN_MAGIC_SIZE) == 0)
+    ret = huffman_decode_blocks(input, output);
+
+  /* stream of blocks */
+  else if (memcmp(magic, HUFFMAN_STREAM_MAGIC, HUFFMAN_MAGIC_SIZE) == 0)
+    ret = huffman_decode_stream_blocks(input, output);
+
+  /* single stream */
+  else
+    ret = huffman_decode_single(input, output, magic);
+
+  return !ret && stream_error(output) ? -1 : ret;
+}
+
+/*
+ * Huffman decoding of a stream (input doesn't need to be seekable).
+ */
+int huffman_decode_stream(FILE *fp_input, FILE *fp_output)
+{
+  struct stream_t input, output;
+
+  stream_init_file(&input, fp_input);
+  stream_init_file(&output, fp_output);
+
+  return huffman_decode_data(&input, &output);
+}
+
+/*
+ * Huffman decoding of a buffer (fails if decoded data doesn't fit in dst_size bytes).
+ */
+int huffman_decode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = huffman_decode_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
+}
+
+/*
+ * Huffman decoding of a file.
+ */
+int huffman_decode(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* decode file */
+  ret = huffman_decode_data(&input, &output);
+
   /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
 
-  return 0;
+  return ret;
 }
@@ -1,7 +1,26 @@
 #ifndef _HUFFMAN_H_
 #define _HUFFMAN_H_
 
+#include <stdio.h>
+
+#define HUFFMAN_BLOCK_SIZE        (1024 * 1024)
+#define HUFFMAN_MAX_BLOCK_SIZE    (256 * 1024 * 1024)
+
+/*
+ * Block flags : encode every block as 4 interleaved bitstreams (faster decoding).
+ */
+#define HUFFMAN_4_STREAMS         0x01
+
 int huffman_encode(const char *input_file, const char *output_file);
+int huffman_encode_blocks(const char *input_file, const char *output_file, size_t block_size, int nb_threads,
+                          int flags);
+int huffman_encode_stream(FILE *fp_input, FILE *fp_output, size_t block_size, int flags);
+int huffman_encode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len);
+size_t huffman_encode_bound(size_t len);
 int huffman_decode(const char *input_file, const char *output_file);
+int huffman_decode_stream(FILE *fp_input, FILE *fp_output);
+int huffman_decode_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len);
 
 #endif
@@ -0,0 +1,66 @@
+#ifndef _HUFFMAN_CODE_H_
+#define _HUFFMAN_CODE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+
+/*
+ * Canonical huffman codes of any alphabet (up to HUFF_MAX_SYMBOLS symbols), shared by codecs entropy coding
+ * their own symbols.
+ */
+#define HUFF_MAX_SYMBOLS          (1 << 16)
+#define HUFF_MAX_CODE_LENGTH      15
+
+/*
+ * Decoding table : the next HUFF_TABLE_BITS bits of input index a primary table. Codes longer than that
+ * are resolved by a link entry pointing to a subtable indexed by the following bits.
+ */
+#define HUFF_TABLE_BITS           11
+#define HUFF_LINK                 (1U << 31)
+
+#define huff_entry(item, len)     (((uint32_t) (len) << 16) | (item))
+#define huff_entry_item(e)        ((e) & 0xFFFF)
+#define huff_entry_len(e)         (((e) >> 16) & 0x3F)
+#define huff_link(offset, bits)   (HUFF_LINK | ((uint32_t) (bits) << 24) | (offset))
+#define huff_link_offset(e)       ((e) & 0xFFFFFF)
+#define huff_link_bits(e)         (((e) >> 24) & 0x1F)
+
+/*
+ * Huffman decoding table.
+ */
+struct huff_table_t {
+  uint32_t *entries;
+  size_t size;
+  int max_len;
+};
+
+int huffman_build_lengths(size_t *freq, int *lengths, size_t nb_symbols, int max_length);
+void huffman_canonical_codes(int *lengths, uint32_t *codes, size_t nb_symbols);
+int huffman_table_build(struct huff_table_t *table, uint32_t *codes, int *lengths, size_t nb_symbols);
+
+/*
+ * Decode next symbol.
+ */
+static inline int huffman_decode_symbol(struct bit_reader_t *br, struct huff_table_t *table)
+{
+  uint32_t e;
+
+  /* make sure the longest code is available */
+  if (br->nb_bits < table->max_len)
+    bit_reader_refill(br);
+
+  /* look up next bits (follow link for long codes) */
+  e = table->entries[br->bits >> (64 - HUFF_TABLE_BITS)];
+  if (e & HUFF_LINK)
+    e = table->entries[huff_link_offset(e) + ((br->bits << HUFF_TABLE_BITS) >> (64 - huff_link_bits(e)))];
+
+  /* consume code */
+  br->bits <<= huff_entry_len(e);
+  br->nb_bits -= huff_entry_len(e);
+
+  return huff_entry_item(e);
+}
+
+#endif
@@ -1,192 +1,1279 @@
 /*
  * LZ77 algorithm = lossless data compression algorithm.
- * This algorithm maintains a sliding window (user defined parameter).
- * 1 - read first window of input file and write it exactly to the output file
- * 2 - try to find a matching pattern of next characher in the window
- *     -> if it matches, write window reference (offset), pattern length and next character
- *     -> else write 0,0 and current character
+ * This algorithm maintains a sliding window (user defined parameter, 32 KiB to 16 MiB).
+ * 1 - write a header (magic and window size)
+ * 2 - try to find a matching pattern of next characters in the window
+ *     -> if it matches, write pattern length, window reference (offset) and next character
+ *     -> else write length 0 and current character
+ * Lengths and offsets are written as varints (7 bits per byte, low bits first). A pattern may overlap
+ * the characters it encodes (offset < length).
+ * Block mode : input is split in blocks compressed in parallel (same tokens, no header per block). Blocks may
+ * be primed by groups : window of every block of a group starts with the end of previous group (it is not encoded
+ * again), so the decoder has it before uncompressing the group in parallel.
  */
 #include <stdio.h>
-#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 
 #include "lz77.h"
+#include "lz_match.h"
+#include "stream.h"
+#include "../data_structures/suffix_array.h"
+#include "../utils/mem.h"
+#include "../utils/thread_pool.h"
 
-#define WINDOW_SIZE       100
-#define LOOK_AHEAD_SIZE   120
-#define BUFFER_SIZE       ((WINDOW_SIZE) + (LOOK_AHEAD_SIZE))
+#define LZ77_MAGIC        "LZ77"
+#define LZ77_BLOCKS_MAGIC "LZ7B"
+#define LZ77_MAGIC_SIZE   4
+#define LZ77_HEADER_SIZE  ((LZ77_MAGIC_SIZE) + 1)
 
 /*
- * Find a "window" match in string "s" of "len". If a match is found, return position in window.
- * Else return -1.
+ * Maximum size of a compressed block (2 bytes per character, see lz77_compress_bound).
  */
-static inline int lz77_match(unsigned char *window, unsigned char *s, int len)
+#define lz77_block_bound(len)   (2 * (size_t) (len))
+
+/*
+ * Maximum size of a token (pattern length + next character).
+ */
+#define LOOK_AHEAD_SIZE   ((LZ77_MAX_MATCH_LEN) + 1)
+
+/*
+ * Characters are kept in a circular buffer (size = power of 2, indexed by position & mask). On encoder side,
+ * first characters of the buffer are copied after its end, so that look ahead buffer and matches (plus the
+ * 3 characters hashed at each position) can be read without wrapping.
+ */
+#define RING_TAIL_SIZE    ((LOOK_AHEAD_SIZE) + 8)
+
+/*
+ * Decoder : matches are copied by chunks, so up to LZ_WILD_COPY_SIZE - 1 characters after a match may be
+ * overwritten (output buffer has LZ_WILD_COPY_SIZE bytes of slack, or last matches are copied one character
+ * at a time). Input file is read by chunks (a token is at most 2 varints of 5 bytes + next character).
+ */
+#define IO_BUF_SIZE       (64 * 1024)
+#define MAX_TOKEN_SIZE    11
+
+/*
+ * Match finder : every position of the window is chained with previous positions starting with the same
+ * 3 bytes (hash table + chain). Matches of 1 or 2 characters (still worth a token) are found with direct
+ * tables on the first 1 or 2 bytes. Positions are stored on 32 bits, relative to a base (multiple of circular
+ * buffer size, so that a relative position still indexes the buffer) : base is moved forward when relative
+ * positions reach REBASE_LIMIT, and positions before the window are then dropped. Base starts one buffer before
+ * input, so that empty entries (0) are out of window.
+ * At max level, a suffix array is built over blocks of positions and the window before them (at most
+ * SA_MAX_SIZE characters, half of it for the block) : it gives the longest match of every position of the
+ * block (sa_match = position of the match, -1 if none). Suffixes are only sorted on their first SA_MAX_DEPTH
+ * characters (longer matches are taken at once by optimal parsing) : beyond it, nearest match is given.
+ */
+#define MAX_HASH_BITS     20
+#define REBASE_LIMIT      (1UL << 31)
+#define SA_MAX_SIZE       (1 << 21)
+#define SA_MAX_DEPTH      ((NICE_LEN) * 2)
+
+#define lz77_hash(s, bits)  ((((s)[0] << 16 | (s)[1] << 8 | (s)[2]) * 2654435761U) >> (32 - (bits)))
+
+struct lz77_matcher_t {
+  const unsigned char *ring;
+  long ring_mask;
+  long window_mask;
+  long next_pos;
+  long base;
+  int hash_bits;
+  uint32_t head2[256 * 256];
+  uint32_t head1[256];
+  uint32_t *head3;
+  uint32_t *prev3;
+  long sa_size;
+  long sa_start;
+  long sa_end;
+  long *sa_match;
+  unsigned char *sa_text;
+};
+
+/*
+ * A match (pattern length + offset in window).
+ */
+struct lz77_match_t {
+  int len;
+  long offset;
+};
+
+/*
+ * Minimum match length taken without checking next position (lazy level) or without optimal parsing (optimal
+ * level).
+ */
+#define NICE_LEN          128
+
+/*
+ * Optimal parsing : shortest path (in bytes) over a block of positions. Node i = first i characters of block
+ * encoded, reached by a token of length len (pattern + next character) and offset.
+ */
+#define OPT_BLOCK_SIZE    4096
+
+struct lz77_node_t {
+  uint32_t cost;
+  int len;
+  long offset;
+};
+
+/*
+ * Default chain depth and window log of each level (greedy and lazy levels keep their match finder in cache : with a
+ * larger window, the chain walk waits on memory on incompressible data).
+ */
+static const int lz77_chain_depths[] = { 0, 4, 16, 32, 32 };
+static const int lz77_window_logs[] = { 0, 17, 17, 20, 20 };
+
+/*
+ * Create a match finder on circular buffer "ring".
+ */
+static struct lz77_matcher_t *lz77_matcher_create(int window_log, const unsigned char *ring, long ring_size)
 {
-  int i, j, k;
+  struct lz77_matcher_t *matcher;
+  int hash_bits;
 
-  for (i = 0; i < WINDOW_SIZE - len; i++) {
-    for (j = 0, k = i; j < len; j++)
-      if (s[j] == window[k])
-        k++;
-      else
-        break;
+  /* hash table = 1/2 of window (fewer positions of other 3 bytes in chains) */
+  hash_bits = window_log - 1 < MAX_HASH_BITS ? window_log - 1 : MAX_HASH_BITS;
+
+  /* chain doesn't need to be initialized : it is only followed from inserted positions */
+  matcher = (struct lz77_matcher_t *) xmalloc(sizeof(struct lz77_matcher_t)
+                                              + (sizeof(uint32_t) << hash_bits) + (sizeof(uint32_t) << window_log));
+  memset(matcher, 0, sizeof(struct lz77_matcher_t) + (sizeof(uint32_t) << hash_bits));
+  matcher->ring = ring;
+  matcher->ring_mask = ring_size - 1;
+  matcher->window_mask = (1L << window_log) - 1;
+  matcher->next_pos = 0;
+  matcher->base = -ring_size;
+  matcher->hash_bits = hash_bits;
+  matcher->head3 = (uint32_t *) (matcher + 1);
+  matcher->prev3 = matcher->head3 + (1L << hash_bits);
+  matcher->sa_size = 0;
+  matcher->sa_start = 0;
+  matcher->sa_end = 0;
+  matcher->sa_match = NULL;
+  matcher->sa_text = NULL;
+
+  return matcher;
+}
+
+/*
+ * Enable suffix array of match finder.
+ */
+static void lz77_matcher_enable_sa(struct lz77_matcher_t *matcher)
+{
+  matcher->sa_size = matcher->window_mask + 1 < SA_MAX_SIZE ? matcher->window_mask + 1 : SA_MAX_SIZE;
+  matcher->sa_match = (long *) xmalloc(sizeof(long) * (matcher->sa_size / 2));
+  matcher->sa_text = (unsigned char *) xmalloc(matcher->sa_size);
+}
+
+/*
+ * Free a match finder.
+ */
+static void lz77_matcher_free(struct lz77_matcher_t *matcher)
+{
+  xfree(matcher->sa_match);
+  xfree(matcher->sa_text);
+  free(matcher);
+}
+
+/*
+ * Build suffix array of next block of positions (starting at pos, end = number of characters in buffer) and
+ * of the window before it. Longest match of a position = nearest suffix starting before it in suffix array
+ * order, on either side (previous/next smaller value), common prefix = minimum lcp between them.
+ */
+static void lz77_matcher_build_sa(struct lz77_matcher_t *matcher, long pos, long end)
+{
+  uint32_t *stack, *stack_lcp, *best_lcp, cur;
+  long block, history, start, n, i, p, r, top;
+  struct suffix_array_t *sa;
 
-    if (j == len)
-      return i;
+  /* block and window (every position of the window is in range of every position of the block) */
+  block = end - pos < matcher->sa_size / 2 ? end - pos : matcher->sa_size / 2;
+  history = pos < matcher->sa_size - block ? pos : matcher->sa_size - block;
+  start = pos - history;
+  n = history + block;
+
+  /* copy characters out of circular buffer */
+  i = start & matcher->ring_mask;
+  p = n < matcher->ring_mask + 1 - i ? n : matcher->ring_mask + 1 - i;
+  memcpy(matcher->sa_text, matcher->ring + i, p);
+  memcpy(matcher->sa_text + p, matcher->ring, n - p);
+
+  /* build suffix array */
+  sa = suffix_array_create(matcher->sa_text, n, SA_MAX_DEPTH);
+  stack = (uint32_t *) xmalloc(sizeof(uint32_t) * n);
+  stack_lcp = (uint32_t *) xmalloc(sizeof(uint32_t) * n);
+  best_lcp = (uint32_t *) xmalloc(sizeof(uint32_t) * block);
+
+  /* previous smaller values (stack = suffixes before r starting before their followers) */
+  for (r = 0, top = 0; r < n; r++) {
+    for (cur = sa->lcp[r]; top > 0 && sa->sa[stack[top - 1]] > sa->sa[r]; top--)
+      if (stack_lcp[top - 1] < cur)
+        cur = stack_lcp[top - 1];
+
+    p = sa->sa[r];
+    if (p >= history) {
+      best_lcp[p - history] = top > 0 ? cur : 0;
+      matcher->sa_match[p - history] = top > 0 && cur > 0 ? start + sa->sa[stack[top - 1]] : -1;
+    }
+
+    stack[top] = r;
+    stack_lcp[top++] = cur;
+  }
+
+  /* next smaller values (nearest match on equal lengths) */
+  for (r = n - 1, top = 0; r >= 0; r--) {
+    for (cur = r + 1 < n ? sa->lcp[r + 1] : 0; top > 0 && sa->sa[stack[top - 1]] > sa->sa[r]; top--)
+      if (stack_lcp[top - 1] < cur)
+        cur = stack_lcp[top - 1];
+
+    p = sa->sa[r];
+    if (p >= history && top > 0 && cur > 0
+        && (cur > best_lcp[p - history]
+            || (cur == best_lcp[p - history] && start + sa->sa[stack[top - 1]] > matcher->sa_match[p - history]))) {
+      best_lcp[p - history] = cur;
+      matcher->sa_match[p - history] = start + sa->sa[stack[top - 1]];
+    }
+
+    stack[top] = r;
+    stack_lcp[top++] = cur;
+  }
+
+  matcher->sa_start = pos;
+  matcher->sa_end = pos + block;
+
+  free(best_lcp);
+  free(stack_lcp);
+  free(stack);
+  suffix_array_free(sa);
+}
+
+/*
+ * Move base of match finder forward, up to window before position pos (positions before it are dropped).
+ */
+static void lz77_matcher_rebase(struct lz77_matcher_t *matcher, long pos)
+{
+  uint32_t *tables[] = { matcher->head1, matcher->head2, matcher->head3, matcher->prev3 };
+  long sizes[] = { 256, 256 * 256, 1L << matcher->hash_bits, matcher->window_mask + 1 };
+  long base, i, j;
+  uint32_t delta;
+
+  base = (pos - matcher->window_mask - 2) & ~matcher->ring_mask;
+  delta = base - matcher->base;
+  matcher->base = base;
+
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < sizes[i]; j++)
+      tables[i][j] = tables[i][j] > delta ? tables[i][j] - delta : 0;
+}
+
+/*
+ * Insert position pos (= s, relative position p) in match finder (len = number of available characters at s).
+ */
+static inline void lz77_matcher_insert(struct lz77_matcher_t *matcher, const unsigned char *s, uint32_t p, long len)
+{
+  uint32_t h;
+
+  matcher->head1[s[0]] = p;
+
+  if (len >= 2)
+    matcher->head2[s[0] << 8 | s[1]] = p;
+
+  if (len >= 3) {
+    h = lz77_hash(s, matcher->hash_bits);
+    matcher->prev3[p & matcher->window_mask] = matcher->head3[h];
+    matcher->head3[h] = p;
+  }
+}
+
+/*
+ * Insert all positions before pos in match finder (end = number of characters in buffer).
+ */
+static inline void lz77_matcher_update(struct lz77_matcher_t *matcher, long pos, long end)
+{
+  if ((unsigned long) (pos - matcher->base) >= REBASE_LIMIT)
+    lz77_matcher_rebase(matcher, pos);
+
+  for (; matcher->next_pos < pos; matcher->next_pos++)
+    lz77_matcher_insert(matcher, matcher->ring + (matcher->next_pos & matcher->ring_mask),
+                        matcher->next_pos - matcher->base, end - matcher->next_pos);
+}
+
+/*
+ * Find matches of look ahead buffer "s" (at position pos) in window : nearest 1 and 2 characters matches, then
+ * matches of the chain, each one longer (and farther) than previous ones, then longest match of the suffix
+ * array if it is longer.
+ * Returns number of matches (last one = longest match).
+ */
+static int lz77_matcher_find(struct lz77_matcher_t *matcher, const unsigned char *s, long pos, int max_len,
+                             int chain_depth, struct lz77_match_t *matches)
+{
+  uint32_t window = matcher->window_mask + 1, cur, cand;
+  int best_len = 0, len, n = 0;
+  long sa_cand;
+
+  lz77_matcher_update(matcher, pos, pos + max_len + 1);
+  cur = pos - matcher->base;
+
+  /* 1 character match (only worth it if offset fits in 1 byte) */
+  cand = matcher->head1[s[0]];
+  if (max_len >= 1 && cur - cand < 128) {
+    matches[n].len = best_len = 1;
+    matches[n++].offset = cur - cand;
+  }
+
+  /* 2 characters match */
+  if (max_len < 2)
+    return n;
+
+  cand = matcher->head2[s[0] << 8 | s[1]];
+  if (cur - cand <= window) {
+    matches[n].len = best_len = 2;
+    matches[n++].offset = cur - cand;
+  }
+
+  /* walk chain of positions starting with the same 3 bytes */
+  if (max_len < 3)
+    return n;
+
+  for (cand = matcher->head3[lz77_hash(s, matcher->hash_bits)];
+       cur - cand <= window && chain_depth-- > 0; cand = matcher->prev3[cand & matcher->window_mask]) {
+    /* can't be longer than best match */
+    if (matcher->ring[(cand & matcher->ring_mask) + best_len] != s[best_len])
+      continue;
+
+    len = lz_match_length(s, matcher->ring + (cand & matcher->ring_mask), max_len);
+    if (len > best_len) {
+      matches[n].len = best_len = len;
+      matches[n++].offset = cur - cand;
+      if (len == max_len)
+        return n;
+    }
+  }
+
+  /* exact longest match */
+  if (pos >= matcher->sa_start && pos < matcher->sa_end
+      && (sa_cand = matcher->sa_match[pos - matcher->sa_start]) >= 0) {
+    len = lz_match_length(s, matcher->ring + (sa_cand & matcher->ring_mask), max_len);
+    if (len > best_len) {
+      matches[n].len = len;
+      matches[n++].offset = pos - sa_cand;
+    }
+  }
+
+  return n;
+}
+
+/*
+ * Write a varint.
+ */
+static void lz77_write_varint(struct stream_t *output, unsigned long value)
+{
+  for (; value >= 0x80; value >>= 7)
+    stream_putc(output, (value & 0x7F) | 0x80);
+
+  stream_putc(output, value);
+}
+
+/*
+ * Parse a varint from buffer *in (ending at in_end). Returns 0 on success, -1 on error.
+ */
+static inline int lz77_parse_varint(const unsigned char **in, const unsigned char *in_end, unsigned long *value)
+{
+  const unsigned char *p = *in;
+  int shift;
+
+  for (*value = 0, shift = 0; p < in_end && shift < 35; shift += 7) {
+    *value |= (unsigned long) (*p & 0x7F) << shift;
+    if (!(*p++ & 0x80)) {
+      *in = p;
+      return 0;
+    }
   }
 
   return -1;
 }
 
 /*
- * Compress a file with lz77 algorithm.
+ * Get size of circular buffer for a window : window + look ahead + room to refill (or write) it by large
+ * chunks.
  */
-int lz77_compress(const char *input_file, const char *output_file)
+static long lz77_ring_size(long window)
 {
-  unsigned char buf[BUFFER_SIZE], *window, *look_ahead;
-  int ret, i, match, shift, len, buf_size;
-  FILE *fp_input, *fp_output;
+  long size;
 
-  /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
-
-  /* read first buffer */
-  len = fread(buf, 1, BUFFER_SIZE, fp_input);
-  if (len < BUFFER_SIZE) {
-    fclose(fp_input);
+  for (size = 1; size < window + 2 * LOOK_AHEAD_SIZE; size <<= 1);
+
+  return size;
+}
+
+/*
+ * Get size of a varint.
+ */
+static inline int lz77_varint_size(unsigned long value)
+{
+  int size;
+
+  for (size = 1; value >= 0x80; value >>= 7)
+    size++;
+
+  return size;
+}
+
+/*
+ * Get size of a token.
+ */
+static inline int lz77_token_size(int len, long offset)
+{
+  return lz77_varint_size(len) + (len > 0 ? lz77_varint_size(offset) : 0) + 1;
+}
+
+/*
+ * Write a token (pattern length, relative position of pattern in window if length > 0, next character).
+ */
+static void lz77_write_token(void *arg, const unsigned char *s, int len, long offset)
+{
+  struct stream_t *output = (struct stream_t *) arg;
+
+  lz77_write_varint(output, len);
+  if (len > 0)
+    lz77_write_varint(output, offset);
+  stream_putc(output, s[len]);
+}
+
+/*
+ * Encode next characters with optimal parsing (end = number of characters in buffer).
+ * Returns number of encoded characters.
+ */
+static long lz77_parse_optimal(struct lz77_matcher_t *matcher, struct lz77_node_t *nodes,
+                               struct lz77_match_t *matches, long pos, long end, int chain_depth,
+                               lz77_token_handler_t handler, void *arg)
+{
+  struct lz77_match_t long_match = { 0, 0 };
+  int k, n, len, max_len;
+  long block, i, j;
+  const unsigned char *s;
+  uint32_t cost;
+
+  /* init nodes */
+  block = end - pos < OPT_BLOCK_SIZE ? end - pos : OPT_BLOCK_SIZE;
+  nodes[0].cost = 0;
+  for (i = 1; i <= block; i++)
+    nodes[i].cost = UINT32_MAX;
+
+  /* compute cheapest way to reach every node */
+  for (i = 0; i < block; i++) {
+    /* literal */
+    if (nodes[i].cost + 2 < nodes[i + 1].cost) {
+      nodes[i + 1].cost = nodes[i].cost + 2;
+      nodes[i + 1].len = 0;
+    }
+
+    /* find matches (keep at least one character for next character) */
+    s = matcher->ring + ((pos + i) & matcher->ring_mask);
+    max_len = end - pos - i - 1 < LOOK_AHEAD_SIZE - 1 ? end - pos - i - 1 : LOOK_AHEAD_SIZE - 1;
+    n = lz77_matcher_find(matcher, s, pos + i, max_len, chain_depth, matches);
+    if (n == 0)
+      continue;
+
+    /* long match : end block here and take it */
+    if (matches[n - 1].len >= NICE_LEN) {
+      long_match = matches[n - 1];
+      block = i;
+      break;
+    }
+
+    /* every length of every match (nearest match for each length) */
+    for (k = 0, len = 1; k < n; k++) {
+      for (; len <= matches[k].len && i + len + 1 <= block; len++) {
+        cost = nodes[i].cost + lz77_token_size(len, matches[k].offset);
+        if (cost < nodes[i + len + 1].cost) {
+          nodes[i + len + 1].cost = cost;
+          nodes[i + len + 1].len = len;
+          nodes[i + len + 1].offset = matches[k].offset;
+        }
+      }
+    }
+  }
+
+  /* reverse path from last node (costs are not needed anymore : store next node in it) */
+  for (j = block; j > 0; j = i) {
+    i = j - nodes[j].len - 1;
+    nodes[i].cost = j;
+  }
+
+  /* write tokens */
+  for (i = 0; i < block; i = j) {
+    j = nodes[i].cost;
+    handler(arg, matcher->ring + ((pos + i) & matcher->ring_mask), nodes[j].len, nodes[j].offset);
+  }
+
+  /* write long match */
+  if (long_match.len > 0) {
+    s = matcher->ring + ((pos + block) & matcher->ring_mask);
+    handler(arg, s, long_match.len, long_match.offset);
+    block += long_match.len + 1;
+  }
+
+  return block;
+}
+
+/*
+ * Get window log used to compress a stream (= options window log, reduced for small inputs).
+ * Returns -1 on invalid options.
+ */
+int lz77_window_log(struct stream_t *input, const struct lz77_options_t *options)
+{
+  int window_log, level;
+  long size;
+
+  /* check options */
+  level = options && options->level ? options->level : LZ77_LEVEL;
+  if (level < LZ77_LEVEL_GREEDY || level > LZ77_LEVEL_MAX)
+    return -1;
+  window_log = options && options->window_log ? options->window_log : lz77_window_logs[level];
+  if (window_log < LZ77_MIN_WINDOW_LOG || window_log > LZ77_MAX_WINDOW_LOG)
+    return -1;
+
+  /* small input : use a smaller window */
+  size = stream_size(input);
+  while (size >= 0 && window_log > LZ77_MIN_WINDOW_LOG && (1L << (window_log - 1)) >= size)
+    window_log--;
+
+  return window_log;
+}
+
+/*
+ * Parse a stream into lz77 tokens (window log given by lz77_window_log), passed to handler. First dict_len
+ * characters of input only prime the window (they are not encoded).
+ */
+static int lz77_parse_dict(struct stream_t *input, int window_log, const struct lz77_options_t *options,
+                           long dict_len, lz77_token_handler_t handler, void *arg)
+{
+  long window, ring_size, ring_mask, end, limit, pos, avail, offset, size, i, n;
+  int len, max_len, level, chain_depth, nb_matches, eof, build_sa;
+  struct lz77_match_t *matches, next_match = { -1, 0 };
+  struct lz77_node_t *nodes = NULL;
+  struct lz77_matcher_t *matcher;
+  unsigned char *ring, *look_ahead;
+
+  /* get options */
+  level = options && options->level ? options->level : LZ77_LEVEL;
+  if (level < LZ77_LEVEL_GREEDY || level > LZ77_LEVEL_MAX
+      || window_log < LZ77_MIN_WINDOW_LOG || window_log > LZ77_MAX_WINDOW_LOG)
+    return -1;
+  chain_depth = options && options->chain_depth > 0 ? options->chain_depth : lz77_chain_depths[level];
+  window = 1L << window_log;
+
+  /* create circular buffer */
+  ring_size = lz77_ring_size(window);
+  ring_mask = ring_size - 1;
+  ring = (unsigned char *) xmalloc(ring_size + RING_TAIL_SIZE);
+  matcher = lz77_matcher_create(window_log, ring, ring_size);
+  if (level == LZ77_LEVEL_MAX)
+    lz77_matcher_enable_sa(matcher);
+
+  /* matches found at a position */
+  matches = (struct lz77_match_t *) xmalloc(sizeof(struct lz77_match_t) * (chain_depth + 3));
+  if (level >= LZ77_LEVEL_OPTIMAL)
+    nodes = (struct lz77_node_t *) xmalloc(sizeof(struct lz77_node_t) * (OPT_BLOCK_SIZE + 1));
+
+  /* lz77 algorithm (pos = position of look ahead buffer in input, end = number of characters read) */
+  for (end = 0, pos = 0, eof = 0;;) {
+    /* next block of suffix array needed (optimal parsing may find matches up to OPT_BLOCK_SIZE positions ahead) */
+    build_sa = matcher->sa_size && pos + OPT_BLOCK_SIZE > matcher->sa_end && (!eof || matcher->sa_end < end);
+
+    /* refill buffer up to first character of window */
+    if (!eof && (end - pos < LOOK_AHEAD_SIZE || build_sa)) {
+      for (limit = pos - window + ring_size; !eof && end < limit; end += n) {
+        i = end & ring_mask;
+        size = limit - end < ring_size - i ? limit - end : ring_size - i;
+        n = stream_read(input, ring + i, size);
+        eof = n < size;
+
+        /* copy first characters after end of buffer */
+        if (i < RING_TAIL_SIZE)
+          memcpy(ring + ring_size + i, ring + i, n < RING_TAIL_SIZE - i ? n : RING_TAIL_SIZE - i);
+      }
+    }
+
+    /* end of input */
+    look_ahead = ring + (pos & ring_mask);
+    avail = end - pos;
+    if (avail <= 0)
+      break;
+
+    /* skip dictionary (its positions are inserted in match finder by next search) */
+    if (pos < dict_len) {
+      pos = dict_len < end ? dict_len : end;
+      continue;
+    }
+
+    /* optimal parsing of next block */
+    if (build_sa)
+      lz77_matcher_build_sa(matcher, pos, end);
+    if (level >= LZ77_LEVEL_OPTIMAL) {
+      pos += lz77_parse_optimal(matcher, nodes, matches, pos, end, chain_depth, handler, arg);
+      continue;
+    }
+
+    /* find best match (keep at least one character for next character) */
+    max_len = avail - 1 < LOOK_AHEAD_SIZE - 1 ? avail - 1 : LOOK_AHEAD_SIZE - 1;
+    if (next_match.len >= 0) {
+      len = next_match.len;
+      offset = next_match.offset;
+      next_match.len = -1;
+    } else {
+      nb_matches = lz77_matcher_find(matcher, look_ahead, pos, max_len, chain_depth, matches);
+      len = nb_matches > 0 ? matches[nb_matches - 1].len : 0;
+      offset = nb_matches > 0 ? matches[nb_matches - 1].offset : 0;
+    }
+
+    /* lazy matching : if next position gives a cheaper encoding (per character), write a literal */
+    if (level == LZ77_LEVEL_LAZY && len > 0 && len < NICE_LEN && len < max_len) {
+      nb_matches = lz77_matcher_find(matcher, look_ahead + 1, pos + 1, max_len - 1, chain_depth, matches);
+      next_match.len = nb_matches > 0 ? matches[nb_matches - 1].len : 0;
+      next_match.offset = nb_matches > 0 ? matches[nb_matches - 1].offset : 0;
+
+      if ((2 + lz77_token_size(next_match.len, next_match.offset)) * (len + 1)
+          < lz77_token_size(len, offset) * (next_match.len + 2)) {
+        handler(arg, look_ahead, 0, 0);
+        pos++;
+        continue;
+      }
+
+      next_match.len = -1;
+    }
+
+    /* emit token */
+    handler(arg, look_ahead, len, offset);
+    pos += len + 1;
+  }
+
+  free(nodes);
+  free(matches);
+  lz77_matcher_free(matcher);
+  free(ring);
+  return 0;
+}
+
+/*
+ * Parse a stream into lz77 tokens (window log given by lz77_window_log), passed to handler.
+ */
+int lz77_parse(struct stream_t *input, int window_log, const struct lz77_options_t *options,
+               lz77_token_handler_t handler, void *arg)
+{
+  return lz77_parse_dict(input, window_log, options, 0, handler, arg);
+}
+
+/*
+ * Compress a stream with lz77 algorithm.
+ */
+static int lz77_compress_data(struct stream_t *input, struct stream_t *output, const struct lz77_options_t *options)
+{
+  int window_log;
+
+  /* get window */
+  window_log = lz77_window_log(input, options);
+  if (window_log < 0)
+    return -1;
+
+  /* write header */
+  stream_write(output, LZ77_MAGIC, LZ77_MAGIC_SIZE);
+  stream_putc(output, window_log);
+
+  /* write tokens */
+  if (lz77_parse(input, window_log, options, lz77_write_token, output))
     return -1;
+
+  return stream_error(output) ? -1 : 0;
+}
+
+/*
+ * Block of characters (src = block characters, preceded by dict_len characters of previous group).
+ */
+struct lz77_block_t {
+  const unsigned char *src;
+  size_t src_len;
+  size_t dict_len;
+  unsigned char *dst;
+  size_t dst_len;
+  int window_log;
+  const struct lz77_options_t *options;
+  int ret;
+};
+
+/*
+ * Block compression job.
+ */
+static void lz77_compress_block_job(void *arg)
+{
+  struct lz77_block_t *block = (struct lz77_block_t *) arg;
+  struct stream_t input, output;
+
+  stream_init_memory(&input, block->src - block->dict_len, block->dict_len + block->src_len,
+                     block->dict_len + block->src_len);
+  stream_init_memory(&output, block->dst, 0, lz77_block_bound(block->src_len));
+  block->ret = lz77_parse_dict(&input, block->window_log, block->options, block->dict_len, lz77_write_token, &output);
+  if (stream_error(&output))
+    block->ret = -1;
+  block->dst_len = output.len;
+}
+
+/*
+ * Write characters [from, to[ of a circular buffer.
+ */
+static void lz77_ring_write(struct stream_t *output, const unsigned char *ring, long ring_mask, long from, long to)
+{
+  long i = from & ring_mask;
+
+  if (i + (to - from) > ring_mask + 1) {
+    stream_write(output, ring + i, ring_mask + 1 - i);
+    from += ring_mask + 1 - i;
+    i = 0;
   }
 
-  /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
-    return ret;
+  stream_write(output, ring + i, to - from);
+}
+
+/*
+ * Decode lz77 tokens until end of input. With a memory output, patterns may also refer to the history
+ * characters before output position.
+ */
+static int lz77_decode(struct stream_t *input, struct stream_t *output, long window, long history)
+{
+  long size, mask, end, written, dst, src, i, n;
+  unsigned char buf_input[IO_BUF_SIZE], *out;
+  const unsigned char *in, *in_end;
+  unsigned long len, offset = 0;
+  int in_place, c, ret;
+
+  /* memory input : read it in place */
+  if (input->fp) {
+    in = in_end = buf_input;
+  } else {
+    in = input->buf + input->pos;
+    in_end = input->buf + input->len;
+  }
+
+  /* memory output : decode in place, else decode in a circular buffer (= window + characters not written yet) */
+  in_place = !output->fp && output->fd < 0;
+  if (in_place) {
+    out = output->buf + output->pos;
+    size = output->size - output->pos;
+    mask = -1;
+  } else {
+    size = lz77_ring_size(window);
+    mask = size - 1;
+    out = (unsigned char *) xmalloc(size + LZ_WILD_COPY_SIZE);
+    history = 0;
   }
 
-  /* write first window directly */
-  fwrite(buf, 1, WINDOW_SIZE, fp_output);
+  /* lz77 algorithm (end = number of decoded characters, written = number of written characters) */
+  for (end = 0, written = 0, ret = -1; !stream_error(output);) {
+    /* refill input buffer */
+    if (input->fp && in_end - in < MAX_TOKEN_SIZE) {
+      n = in_end - in;
+      memmove(buf_input, in, n);
+      in = buf_input;
+      in_end = buf_input + n + stream_read(input, buf_input + n, IO_BUF_SIZE - n);
+    }
+
+    /* end of input = end of data */
+    if (in == in_end) {
+      ret = 0;
+      break;
+    }
 
-  /* lz77 algorithm */
-  for (buf_size = BUFFER_SIZE; buf_size > WINDOW_SIZE;) {
-    /* set window and look ahead buffer */
-    window = buf;
-    look_ahead = window + WINDOW_SIZE;
+    /* read pattern length, pattern offset and next character */
+    if (lz77_parse_varint(&in, in_end, &len) || len >= LOOK_AHEAD_SIZE)
+      break;
+    if (len > 0 && (lz77_parse_varint(&in, in_end, &offset) || offset == 0
+                    || offset > (unsigned long) (end + history) || offset > (unsigned long) window))
+      break;
+    if (in == in_end)
+      break;
+    c = *in++;
 
-    /* find best match */
-    for (i = buf_size - WINDOW_SIZE - 1, match = -1; i > 0; i--) {
-      match = lz77_match(window, look_ahead, i);
-      if (match != -1)
+    /* output buffer full (or characters not written yet would be overwritten) */
+    if (end + (long) len + 1 + LZ_WILD_COPY_SIZE - written > size) {
+      if (in_place && end + (long) len + 1 > size) {
+        output->error = 1;
         break;
+      }
+
+      if (!in_place) {
+        lz77_ring_write(output, out, mask, written, end);
+        written = end;
+      }
     }
 
-    /*
-     * Write result to output file :
-     * 1 - relative position of pattern in window
-     * 2 - pattern length
-     * 3 - next character
-     */
-    if (match == -1) {
-      fputc(0, fp_output);
-      fputc(0, fp_output);
-      fputc(look_ahead[0], fp_output);
-      shift = 1;
-    } else {
-      fputc(WINDOW_SIZE - match, fp_output);
-      fputc(i, fp_output);
-      fputc(look_ahead[i], fp_output);
-      shift = i + 1;
+    /* decode pattern (fast copy if it doesn't wrap around circular buffer or reach end of output buffer) */
+    if (len > 0) {
+      dst = end & mask;
+      src = (end - (long) offset) & mask;
+      if (dst + (long) len + LZ_WILD_COPY_SIZE <= (in_place ? size : size + LZ_WILD_COPY_SIZE)
+          && src + (long) len <= size)
+        lz_copy_match(out + dst, out + src, len);
+      else
+        for (i = 0; i < (long) len; i++)
+          out[(dst + i) & mask] = out[(src + i) & mask];
     }
 
-    /* shift buffer */
-    for (i = 0; i < buf_size - shift; i++)
-      buf[i] = buf[i + shift];
+    /* add next character */
+    out[(end + len) & mask] = c;
+    end += len + 1;
+  }
+
+  /* update memory input position */
+  if (!input->fp)
+    input->pos = in - input->buf;
 
-    /* read next bytes */
-    if (buf_size == BUFFER_SIZE)
-      buf_size = BUFFER_SIZE - shift + fread(&buf[BUFFER_SIZE - shift], 1, shift, fp_input);
-    else
-      buf_size -= shift;
+  /* update memory output or write remaining characters */
+  if (in_place) {
+    output->pos += end;
+    if (output->pos > output->len)
+      output->len = output->pos;
+  } else {
+    if (ret == 0)
+      lz77_ring_write(output, out, mask, written, end);
+    free(out);
   }
 
+  return stream_error(output) ? -1 : ret;
+}
+
+/*
+ * Block uncompression job (dst = dst_len characters to decode, preceded by dict_len characters of previous group).
+ */
+static void lz77_uncompress_block_job(void *arg)
+{
+  struct lz77_block_t *block = (struct lz77_block_t *) arg;
+  struct stream_t input, output;
+
+  stream_init_memory(&input, block->src, block->src_len, block->src_len);
+  stream_init_memory(&output, block->dst - block->dict_len, block->dict_len, block->dict_len + block->dst_len);
+  output.pos = block->dict_len;
+  block->ret = lz77_decode(&input, &output, 1L << block->window_log, block->dict_len);
+  if (!block->ret && output.len != block->dict_len + block->dst_len)
+    block->ret = -1;
+}
+
+/*
+ * Uncompress a file made of blocks (magic has already been read).
+ */
+static int lz77_uncompress_blocks(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char *buf_input = NULL, *buf_output = NULL, *dict = NULL;
+  uint32_t *index = NULL, nb_blocks, block_size, group = 0;
+  size_t i, n, batch, len, dict_len, slot_size, end;
+  struct lz77_block_t *blocks = NULL;
+  struct thread_pool_t *pool = NULL;
+  int ret = -1, flags, window_log;
+  uint64_t nb_items;
+
+  /* read header */
+  if ((flags = stream_getc(input)) == EOF || (window_log = stream_getc(input)) == EOF
+      || stream_read(input, &nb_items, sizeof(uint64_t)) != sizeof(uint64_t)
+      || stream_read(input, &block_size, sizeof(uint32_t)) != sizeof(uint32_t)
+      || stream_read(input, &nb_blocks, sizeof(uint32_t)) != sizeof(uint32_t)
+      || ((flags & LZ77_PRIME) && stream_read(input, &group, sizeof(uint32_t)) != sizeof(uint32_t)))
+    return -1;
+
+  /* check header */
+  if ((flags & ~LZ77_PRIME) || window_log < LZ77_MIN_WINDOW_LOG || window_log > LZ77_MAX_WINDOW_LOG
+      || !block_size || block_size > LZ77_MAX_BLOCK_SIZE || nb_blocks != (nb_items + block_size - 1) / block_size
+      || ((flags & LZ77_PRIME) && !group))
+    return -1;
+
+  /* read block index (fails if header announces more blocks than input holds) */
+  index = (uint32_t *) stream_read_array(input, nb_blocks, sizeof(uint32_t));
+  if (!index)
+    goto out;
+
+  /* create thread pool */
+  pool = thread_pool_create(0);
+  if (!pool)
+    goto out;
+
+  /* allocate a batch of blocks (one per thread, primed blocks : output buffer starts with end of previous group) */
+  dict_len = group ? (1UL << window_log < block_size ? 1UL << window_log : block_size) : 0;
+  slot_size = dict_len + block_size;
+  batch = pool->nb_threads;
+  blocks = (struct lz77_block_t *) xmalloc(sizeof(struct lz77_block_t) * batch);
+  buf_input = (unsigned char *) xmalloc(lz77_block_bound(block_size) * batch);
+  buf_output = (unsigned char *) xmalloc(slot_size * batch);
+  if (dict_len)
+    dict = (unsigned char *) xmalloc(dict_len);
+
+  for (i = 0; i < nb_blocks; i += n) {
+    /* a batch of primed blocks stays in a group (next group needs the end of this one) */
+    end = group && (i / group + 1) * group < nb_blocks ? (i / group + 1) * group : nb_blocks;
+
+    /* read a batch of blocks */
+    for (n = 0, len = 0; n < batch && i + n < end; n++) {
+      if (index[i + n] > lz77_block_bound(block_size))
+        goto out;
+
+      blocks[n].src = buf_input + len;
+      blocks[n].src_len = index[i + n];
+      blocks[n].dict_len = group && i >= group ? dict_len : 0;
+      blocks[n].dst = buf_output + n * slot_size + dict_len;
+      blocks[n].dst_len = i + n < nb_blocks - 1 ? block_size : nb_items - (uint64_t) (nb_blocks - 1) * block_size;
+      blocks[n].window_log = window_log;
+      if (blocks[n].dict_len)
+        memcpy(blocks[n].dst - dict_len, dict, dict_len);
+      len += index[i + n];
+    }
+
+    if (stream_read(input, buf_input, len) != len)
+      goto out;
+
+    /* uncompress blocks */
+    for (n = 0; n < batch && i + n < end; n++)
+      thread_pool_submit(pool, lz77_uncompress_block_job, &blocks[n]);
+    thread_pool_wait(pool);
+
+    /* write blocks */
+    for (n = 0; n < batch && i + n < end; n++) {
+      if (blocks[n].ret)
+        goto out;
+
+      stream_write(output, blocks[n].dst, blocks[n].dst_len);
+    }
+
+    /* write error */
+    if (stream_error(output))
+      goto out;
+
+    /* keep end of group for next one */
+    if (dict_len && i + n == end && end < nb_blocks)
+      memcpy(dict, blocks[n - 1].dst + blocks[n - 1].dst_len - dict_len, dict_len);
+  }
+
+  ret = 0;
+out:
+  /* free thread pool and buffers */
+  thread_pool_free(pool);
+  xfree(blocks);
+  xfree(buf_input);
+  xfree(buf_output);
+  xfree(dict);
+  xfree(index);
+
+  return ret;
+}
+
+/*
+ * Uncompress a stream with lz77 algorithm (magic has already been read).
+ */
+static int lz77_uncompress_single(struct stream_t *input, struct stream_t *output)
+{
+  int window_log;
+
+  /* read header */
+  window_log = stream_getc(input);
+  if (window_log < LZ77_MIN_WINDOW_LOG || window_log > LZ77_MAX_WINDOW_LOG)
+    return -1;
+
+  return lz77_decode(input, output, 1L << window_log, 0);
+}
+
+/*
+ * Uncompress a stream with lz77 algorithm (any format).
+ */
+static int lz77_uncompress_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char magic[LZ77_MAGIC_SIZE];
+
+  /* read magic */
+  if (stream_read(input, magic, LZ77_MAGIC_SIZE) != LZ77_MAGIC_SIZE)
+    return -1;
+
+  /* independent blocks */
+  if (memcmp(magic, LZ77_BLOCKS_MAGIC, LZ77_MAGIC_SIZE) == 0)
+    return lz77_uncompress_blocks(input, output);
+
+  /* single stream */
+  if (memcmp(magic, LZ77_MAGIC, LZ77_MAGIC_SIZE) == 0)
+    return lz77_uncompress_single(input, output);
+
+  return -1;
+}
+
+/*
+ * Compress a file with lz77 algorithm (options = NULL for default options).
+ */
+int lz77_compress_options(const char *input_file, const char *output_file, const struct lz77_options_t *options)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* compress file */
+  ret = lz77_compress_data(&input, &output, options);
+
   /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
 
-  return 0;
+  return ret;
 }
 
 /*
- * Uncompress a file with lz77 algorithm.
+ * Compress a file with lz77 algorithm.
  */
-int lz77_uncompress(const char *input_file, const char *output_file)
+int lz77_compress(const char *input_file, const char *output_file)
+{
+  return lz77_compress_options(input_file, output_file, NULL);
+}
+
+/*
+ * Compress a file with lz77 algorithm, by blocks compressed in parallel (options = NULL for default options,
+ * nb_threads <= 0 = one thread per processor).
+ * Output = magic, flags, window log, number of characters, block size, number of blocks, group size (primed blocks
+ * only), block index (= compressed size of every block) and compressed blocks.
+ */
+int lz77_compress_blocks(const char *input_file, const char *output_file, const struct lz77_options_t *options,
+                         size_t block_size, int nb_threads, int flags)
 {
-  unsigned char window[WINDOW_SIZE], buf_in[3], buf_out[WINDOW_SIZE];
-  int ret, offset, i, j, shift, len;
-  FILE *fp_input, *fp_output;
+  unsigned char *buf_input = NULL, *buf_output = NULL, *dict = NULL;
+  uint32_t *index = NULL, nb_blocks, block_size32, group = 0;
+  size_t i, n, batch, bound, dict_len, slot_size, end;
+  struct lz77_block_t *blocks = NULL;
+  struct thread_pool_t *pool = NULL;
+  struct stream_t input, output;
+  int ret, window_log;
+  uint64_t nb_items;
+  off_t size, index_pos;
+
+  /* check block size and flags */
+  if (!block_size || block_size > LZ77_MAX_BLOCK_SIZE || (flags & ~LZ77_PRIME))
+    return -1;
 
   /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
 
   /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
     return ret;
   }
 
-  /* write first uncompressed window */
-  len = fread(window, 1, WINDOW_SIZE, fp_input);
-  fwrite(window, 1, len, fp_output);
+  /* get input size and window */
+  ret = -1;
+  size = stream_size(&input);
+  window_log = lz77_window_log(&input, options);
+  if (size < 0 || window_log < 0)
+    goto out;
+
+  /* window doesn't need to be larger than a block */
+  while (window_log > LZ77_MIN_WINDOW_LOG && (1UL << (window_log - 1)) >= block_size)
+    window_log--;
+
+  /* primed blocks : window starts with end of previous group */
+  dict_len = 0;
+  if (flags & LZ77_PRIME) {
+    dict_len = 1UL << window_log < block_size ? 1UL << window_log : block_size;
+    group = LZ77_PRIME_GROUP;
+  }
 
-  /* end of file */
-  if (len != WINDOW_SIZE)
+  /* number of blocks */
+  nb_items = size;
+  if ((nb_items + block_size - 1) / block_size > UINT32_MAX)
     goto out;
+  nb_blocks = (nb_items + block_size - 1) / block_size;
+  block_size32 = block_size;
 
-  /* lz77 algorithm */
-  while (1) {
-    /* read next 2 characters */
-    len = fread(buf_in, 1, 3, fp_input);
-    if (len != 3)
-      break;
+  /* write header */
+  stream_write(&output, LZ77_BLOCKS_MAGIC, LZ77_MAGIC_SIZE);
+  stream_putc(&output, flags);
+  stream_putc(&output, window_log);
+  stream_write(&output, &nb_items, sizeof(uint64_t));
+  stream_write(&output, &block_size32, sizeof(uint32_t));
+  stream_write(&output, &nb_blocks, sizeof(uint32_t));
+  if (group)
+    stream_write(&output, &group, sizeof(uint32_t));
 
-    /* extract pattern offset, length and next char */
-    offset = (int) buf_in[0];
-    len = (int) buf_in[1];
-    shift = len + 1;
+  /* write temporary block index */
+  index_pos = stream_tell(&output);
+  index = (uint32_t *) xmalloc(sizeof(uint32_t) * (nb_blocks + 1));
+  memset(index, 0, sizeof(uint32_t) * (nb_blocks + 1));
+  stream_write(&output, index, sizeof(uint32_t) * nb_blocks);
 
-    /* decode and write pattern */
-    if (len > 0) {
-      /* decode pattern */
-      for (i = 0, j = WINDOW_SIZE - offset; i < len; i++, j++)
-        buf_out[i] = window[j];
+  /* create thread pool */
+  pool = thread_pool_create(nb_threads);
+  if (!pool)
+    goto out;
+
+  /* allocate a batch of blocks (one per thread, primed blocks : input buffer starts with end of previous group) */
+  batch = pool->nb_threads;
+  bound = lz77_block_bound(block_size);
+  slot_size = dict_len + block_size;
+  blocks = (struct lz77_block_t *) xmalloc(sizeof(struct lz77_block_t) * batch);
+  buf_output = (unsigned char *) xmalloc(bound * batch);
+  if (input.fp || dict_len)
+    buf_input = (unsigned char *) xmalloc(slot_size * batch);
+  if (dict_len)
+    dict = (unsigned char *) xmalloc(dict_len);
+
+  for (i = 0; i < nb_blocks; i += n) {
+    /* a batch of primed blocks stays in a group (next group needs the end of this one) */
+    end = group && (i / group + 1) * group < nb_blocks ? (i / group + 1) * group : nb_blocks;
 
-      /* write pattern */
-      fwrite(buf_out, 1, len, fp_output);
+    /* read a batch of blocks (memory input of unprimed blocks is compressed in place) */
+    for (n = 0; n < batch && i + n < end; n++) {
+      if (input.fp) {
+        blocks[n].src = buf_input + n * slot_size + dict_len;
+        blocks[n].src_len = stream_read(&input, (unsigned char *) blocks[n].src, block_size);
+      } else {
+        blocks[n].src = input.buf + input.pos;
+        blocks[n].src_len = input.len - input.pos < block_size ? input.len - input.pos : block_size;
+        input.pos += blocks[n].src_len;
+      }
+
+      blocks[n].dict_len = group && i >= group ? dict_len : 0;
+      blocks[n].dst = buf_output + n * bound;
+      blocks[n].window_log = window_log;
+      blocks[n].options = options;
+
+      /* primed block : copy it after end of previous group */
+      if (dict_len) {
+        if (!input.fp) {
+          memcpy(buf_input + n * slot_size + dict_len, blocks[n].src, blocks[n].src_len);
+          blocks[n].src = buf_input + n * slot_size + dict_len;
+        }
+        if (blocks[n].dict_len)
+          memcpy((unsigned char *) blocks[n].src - dict_len, dict, dict_len);
+      }
     }
 
-    /* write next character */
-    fputc(buf_in[2], fp_output);
+    /* compress blocks */
+    for (n = 0; n < batch && i + n < end; n++)
+      thread_pool_submit(pool, lz77_compress_block_job, &blocks[n]);
+    thread_pool_wait(pool);
+
+    /* write blocks */
+    for (n = 0; n < batch && i + n < end; n++) {
+      if (blocks[n].ret)
+        goto out;
 
-    /* shift window */
-    for (i = 0; i < WINDOW_SIZE - shift; i++)
-      window[i] = window[i + shift];
+      stream_write(&output, blocks[n].dst, blocks[n].dst_len);
+      index[i + n] = blocks[n].dst_len;
+    }
 
-    /* copy next characters from output buffer to window */
-    for (i = 0, j = WINDOW_SIZE - shift; i < len; i++, j++)
-      window[j] = buf_out[i];
-    window[WINDOW_SIZE - 1] = buf_in[2];
+    /* keep end of group for next one */
+    if (dict_len && i + n == end && end < nb_blocks)
+      memcpy(dict, blocks[n - 1].src + blocks[n - 1].src_len - dict_len, dict_len);
   }
 
+  /* write final block index */
+  if (stream_seek(&output, index_pos) != 0)
+    goto out;
+  stream_write(&output, index, sizeof(uint32_t) * nb_blocks);
+
+  ret = 0;
 out:
+  /* free thread pool and buffers */
+  thread_pool_free(pool);
+  xfree(blocks);
+  xfree(buf_input);
+  xfree(buf_output);
+  xfree(dict);
+  xfree(index);
+
   /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
 
-  return 0;
+  return ret;
+}
+
+/*
+ * Uncompress a file with lz77 algorithm.
+ */
+int lz77_uncompress(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* uncompress file */
+  ret = lz77_uncompress_data(&input, &output);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * Maximum size of a lz77 compressed buffer (= header + 2 bytes per character : a pattern is never
+ * longer than the characters it encodes).
+ */
+size_t lz77_compress_bound(size_t len)
+{
+  return LZ77_HEADER_SIZE + 2 * len;
+}
+
+/*
+ * Compress a buffer with lz77 algorithm (lz77_compress_bound(src_len) bytes are always enough).
+ */
+int lz77_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                         size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lz77_compress_data(&input, &output, NULL);
+  *dst_len = output.len;
+
+  return ret;
+}
+
+/*
+ * Uncompress a buffer with lz77 algorithm (fails if uncompressed data doesn't fit in dst_size bytes).
+ */
+int lz77_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                           size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lz77_uncompress_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
 }
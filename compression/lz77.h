@@ -1,7 +1,77 @@
 #ifndef _LZ77_H_
 #define _LZ77_H_
 
+#include <stdio.h>
+
+/*
+ * Window size = 1 << window log (min and max, default depends on level).
+ */
+#define LZ77_MIN_WINDOW_LOG   15
+#define LZ77_MAX_WINDOW_LOG   24
+
+/*
+ * Maximum length of a pattern (a token encodes a pattern and the next character).
+ */
+#define LZ77_MAX_MATCH_LEN    ((1 << 16) - 1)
+
+/*
+ * Block mode : default and maximum block size.
+ */
+#define LZ77_BLOCK_SIZE       (4 * 1024 * 1024)
+#define LZ77_MAX_BLOCK_SIZE   (256 * 1024 * 1024)
+
+/*
+ * Block flags : prime window of every block with the end of previous group of LZ77_PRIME_GROUP blocks (better
+ * compression, blocks of a group are still uncompressed in parallel). Priming by group instead of by previous block
+ * costs ratio on repetitive input : 500289 bytes instead of 33643 for a 6.3 MB text file with 256 KiB blocks (and
+ * a 256 KiB window).
+ */
+#define LZ77_PRIME            0x01
+#define LZ77_PRIME_GROUP      16
+
+/*
+ * Compression levels :
+ * - greedy = take longest match found
+ * - lazy = also check if next position gives a better match
+ * - optimal = cheapest sequence of tokens over blocks of input
+ * - max = optimal, with exact longest matches given by a suffix array (slow)
+ */
+#define LZ77_LEVEL_GREEDY     1
+#define LZ77_LEVEL_LAZY       2
+#define LZ77_LEVEL_OPTIMAL    3
+#define LZ77_LEVEL_MAX        4
+#define LZ77_LEVEL            LZ77_LEVEL_LAZY
+
+/*
+ * Compression options (0 = default value, default window and chain depth = number of candidates checked by the
+ * match finder depend on level).
+ */
+struct lz77_options_t {
+  int window_log;
+  int chain_depth;
+  int level;
+};
+
+/*
+ * Token handler : called for every token of a parse = characters s (pattern of len characters at offset,
+ * len = 0 if no pattern, then next character s[len]).
+ */
+typedef void (*lz77_token_handler_t)(void *arg, const unsigned char *s, int len, long offset);
+
+struct stream_t;
+
 int lz77_compress(const char *input_file, const char *output_file);
+int lz77_compress_options(const char *input_file, const char *output_file, const struct lz77_options_t *options);
+int lz77_compress_blocks(const char *input_file, const char *output_file, const struct lz77_options_t *options,
+                         size_t block_size, int nb_threads, int flags);
 int lz77_uncompress(const char *input_file, const char *output_file);
+int lz77_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                         size_t *dst_len);
+int lz77_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                           size_t *dst_len);
+size_t lz77_compress_bound(size_t len);
+int lz77_window_log(struct stream_t *input, const struct lz77_options_t *options);
+int lz77_parse(struct stream_t *input, int window_log, const struct lz77_options_t *options,
+               lz77_token_handler_t handler, void *arg);
 
 #endif
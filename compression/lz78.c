@@ -5,167 +5,931 @@
  * 2 - if the character is already in the dictionnary (start at root), go to next character and update tree node
  *     if the character is not in the dictionnary, add it to the dictionnary and write the previous node id and then character
  * 3 - write final sequence
+ * Output starts with a header (magic, mode, dictionnary size log and policy), streams without header are old pairs
+ * streams (with an unbounded dictionnary).
+ * Pairs mode : every phrase is written as its parent id (int) and its last character.
+ * LZW mode : dictionnary starts with all characters, every phrase is written as the code of its parent only (its
+ * last character is the first character of next phrase). Codes are written with the number of bits needed by the
+ * largest code (9 bits first, then 10...) and end with a stop code.
+ * The dictionnary holds at most 1 << dict_bits phrases. When it is full, it is frozen, reset, or its least recently
+ * used phrase is replaced (prune). The decoder applies the same policy at the same time, so its memory is bounded
+ * the same way.
+ * The decoder copies every phrase from its last occurrence in output (its characters are only rebuilt from the
+ * dictionnary when this occurrence has left the decoder window).
  */
 #include <stdio.h>
 #include <stdlib.h>
-#include <errno.h>
+#include <string.h>
+#include <stdint.h>
 
 #include "lz78.h"
-#include "../data_structures/trie.h"
+#include "stream.h"
+#include "bitstream.h"
 #include "../utils/mem.h"
 
+#define LZ78_MAGIC          "LZ78"
+#define LZ78_MAGIC_SIZE     4
+#define LZ78_HEADER_SIZE    ((LZ78_MAGIC_SIZE) + 3)
+
 /*
- * Compress a file with lz78 algorithm.
+ * Pairs ids : root (= empty phrase), then phrases.
  */
-int lz78_compress(const char *input_file, const char *output_file)
+#define LZ78_FIRST_ID       1
+
+/*
+ * LZW codes : characters, stop code (= root), then phrases.
+ */
+#define LZW_STOP_CODE       256
+#define LZW_FIRST_CODE      257
+#define LZW_MIN_CODE_BITS   9
+
+#define IO_BUF_SIZE         (64 * 1024)
+
+/*
+ * Decoder window : decoded characters not written yet and history (phrases are copied from their last occurrence
+ * when it is still in the window).
+ */
+#define LZ78_WINDOW_SIZE    (4 * 1024 * 1024)
+
+/*
+ * Encoder hash table : child id of every (parent id, character) pair, with open addressing (linear probing, flat
+ * arrays of keys and ids, grown to stay at most half full).
+ */
+#define LZ78_HASH_MIN_BITS  12
+#define LZ78_HASH_EMPTY     UINT64_MAX
+
+#define lz78_hash_key(parent, c)    ((uint64_t) (parent) << 8 | (c))
+#define lz78_hash_func(key, bits)   (((key) * 0x9E3779B97F4A7C15ULL) >> (64 - (bits)))
+
+struct lz78_hash_t {
+  uint64_t *keys;
+  int *ids;
+  int bits;
+  long nb_entries;
+};
+
+/*
+ * Dictionnary : parent and last character of every phrase (root has no parent, ids below first id = root and
+ * characters are never replaced). Arrays grow up to max size (0 = unbounded).
+ * Prune policy : phrases without children are kept in a list, least recently used first (a phrase is used when it
+ * is written, added, or when it loses its last child).
+ * Decoder dictionnary also keeps length and last output position of every phrase (-1 = none).
+ */
+struct lz78_dict_t {
+  int *parent;
+  unsigned char *c;
+  int *len;
+  long *offset;
+  int *nb_children;
+  int *lru_prev;
+  int *lru_next;
+  int lru_head;
+  int lru_tail;
+  int first_id;
+  int next_id;
+  int size;
+  int max_size;
+  int policy;
+  int decoder;
+  struct lz78_hash_t hash;
+};
+
+/*
+ * Decoder output window : characters [base, end[ are in buffer, characters before written are written to output.
+ * Memory output is decoded in place (window = whole output).
+ */
+struct lz78_window_t {
+  struct stream_t *output;
+  unsigned char *buf;
+  long size;
+  long base;
+  long end;
+  long written;
+  int in_place;
+};
+
+/*
+ * Init a hash table with 1 << bits slots.
+ */
+static void lz78_hash_init(struct lz78_hash_t *hash, int bits)
 {
-  struct trie_t *root = NULL, *node, *next;
-  FILE *fp_input, *fp_output;
-  int ret, c, id = 0;
+  hash->keys = (uint64_t *) xmalloc(sizeof(uint64_t) << bits);
+  hash->ids = (int *) xmalloc(sizeof(int) << bits);
+  memset(hash->keys, 0xFF, sizeof(uint64_t) << bits);
+  hash->bits = bits;
+  hash->nb_entries = 0;
+}
 
-  /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
+/*
+ * Free a hash table.
+ */
+static void lz78_hash_free(struct lz78_hash_t *hash)
+{
+  xfree(hash->keys);
+  xfree(hash->ids);
+}
 
-  /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
-    return ret;
+/*
+ * Find child of a node (returns -1 if not found).
+ */
+static inline int lz78_hash_find(struct lz78_hash_t *hash, int parent, int c)
+{
+  uint64_t key = lz78_hash_key(parent, c), mask = (1ULL << hash->bits) - 1;
+  uint64_t i;
+
+  for (i = lz78_hash_func(key, hash->bits); hash->keys[i] != LZ78_HASH_EMPTY; i = (i + 1) & mask)
+    if (hash->keys[i] == key)
+      return hash->ids[i];
+
+  return -1;
+}
+
+/*
+ * Insert a child (not in hash table yet).
+ */
+static void lz78_hash_insert(struct lz78_hash_t *hash, int parent, int c, int id)
+{
+  uint64_t key = lz78_hash_key(parent, c), mask, i, j;
+  struct lz78_hash_t old;
+
+  /* table half full : rehash entries in a table twice larger */
+  if (2 * (hash->nb_entries + 1) > (1L << hash->bits)) {
+    old = *hash;
+    lz78_hash_init(hash, old.bits + 1);
+    mask = (1ULL << hash->bits) - 1;
+
+    for (j = 0; j < (1ULL << old.bits); j++) {
+      if (old.keys[j] == LZ78_HASH_EMPTY)
+        continue;
+
+      for (i = lz78_hash_func(old.keys[j], hash->bits); hash->keys[i] != LZ78_HASH_EMPTY; i = (i + 1) & mask);
+      hash->keys[i] = old.keys[j];
+      hash->ids[i] = old.ids[j];
+    }
+
+    hash->nb_entries = old.nb_entries;
+    lz78_hash_free(&old);
   }
 
-  /* write temporary dict size */
-  fwrite(&id, sizeof(int), 1, fp_output);
+  /* insert entry */
+  mask = (1ULL << hash->bits) - 1;
+  for (i = lz78_hash_func(key, hash->bits); hash->keys[i] != LZ78_HASH_EMPTY; i = (i + 1) & mask);
+  hash->keys[i] = key;
+  hash->ids[i] = id;
+  hash->nb_entries++;
+}
 
-  /* insert root node */
-  root = trie_insert(root, 0, id++);
-  if (!root) {
-    ret = -1;
-    goto out;
+/*
+ * Remove a child (following entries of its cluster are moved back if their slot is not reachable anymore).
+ */
+static void lz78_hash_remove(struct lz78_hash_t *hash, int parent, int c)
+{
+  uint64_t key = lz78_hash_key(parent, c), mask = (1ULL << hash->bits) - 1;
+  uint64_t i, j, h;
+
+  /* find entry */
+  for (i = lz78_hash_func(key, hash->bits); hash->keys[i] != key; i = (i + 1) & mask)
+    if (hash->keys[i] == LZ78_HASH_EMPTY)
+      return;
+
+  /* entry j can move to i if its slot h is not in ]i, j] */
+  for (j = (i + 1) & mask; hash->keys[j] != LZ78_HASH_EMPTY; j = (j + 1) & mask) {
+    h = lz78_hash_func(hash->keys[j], hash->bits);
+    if (i < j ? (h <= i || h > j) : (h <= i && h > j)) {
+      hash->keys[i] = hash->keys[j];
+      hash->ids[i] = hash->ids[j];
+      i = j;
+    }
   }
 
-  /* create dictionnary */
-  for (node = root;;) {
+  hash->keys[i] = LZ78_HASH_EMPTY;
+  hash->nb_entries--;
+}
+
+/*
+ * Grow dictionnary arrays.
+ */
+static void lz78_dict_grow(struct lz78_dict_t *dict, int size)
+{
+  dict->parent = (int *) xrealloc(dict->parent, sizeof(int) * size);
+  dict->c = (unsigned char *) xrealloc(dict->c, size);
+
+  if (dict->decoder) {
+    dict->len = (int *) xrealloc(dict->len, sizeof(int) * size);
+    dict->offset = (long *) xrealloc(dict->offset, sizeof(long) * size);
+  }
+
+  if (dict->policy == LZ78_POLICY_PRUNE) {
+    dict->nb_children = (int *) xrealloc(dict->nb_children, sizeof(int) * size);
+    dict->lru_prev = (int *) xrealloc(dict->lru_prev, sizeof(int) * size);
+    dict->lru_next = (int *) xrealloc(dict->lru_next, sizeof(int) * size);
+  }
+
+  dict->size = size;
+}
+
+/*
+ * Init a dictionnary with root (= first_id - 1) and characters (ids below root). Encoder dictionnary also has a
+ * hash table to find children.
+ */
+static void lz78_dict_init(struct lz78_dict_t *dict, int first_id, int max_size, int policy, int encoder)
+{
+  int i;
+
+  dict->parent = NULL;
+  dict->c = NULL;
+  dict->len = NULL;
+  dict->offset = NULL;
+  dict->nb_children = NULL;
+  dict->lru_prev = NULL;
+  dict->lru_next = NULL;
+  dict->lru_head = -1;
+  dict->lru_tail = -1;
+  dict->first_id = first_id;
+  dict->next_id = first_id;
+  dict->max_size = max_size;
+  dict->policy = policy;
+  dict->decoder = !encoder;
+  lz78_dict_grow(dict, 2 * first_id);
+
+  /* root and characters */
+  dict->parent[first_id - 1] = -1;
+  for (i = 0; i < first_id - 1; i++) {
+    dict->parent[i] = first_id - 1;
+    dict->c[i] = i;
+  }
+
+  if (dict->nb_children)
+    memset(dict->nb_children, 0, sizeof(int) * first_id);
+
+  if (dict->decoder) {
+    for (i = 0; i < first_id; i++) {
+      dict->len[i] = i < first_id - 1;
+      dict->offset[i] = -1;
+    }
+  }
+
+  dict->hash.keys = NULL;
+  dict->hash.ids = NULL;
+  if (encoder)
+    lz78_hash_init(&dict->hash, LZ78_HASH_MIN_BITS);
+}
+
+/*
+ * Free a dictionnary.
+ */
+static void lz78_dict_free(struct lz78_dict_t *dict)
+{
+  xfree(dict->parent);
+  xfree(dict->c);
+  xfree(dict->len);
+  xfree(dict->offset);
+  xfree(dict->nb_children);
+  xfree(dict->lru_prev);
+  xfree(dict->lru_next);
+  lz78_hash_free(&dict->hash);
+}
+
+/*
+ * Remove a phrase from least recently used list.
+ */
+static inline void lz78_dict_lru_remove(struct lz78_dict_t *dict, int id)
+{
+  if (dict->lru_prev[id] >= 0)
+    dict->lru_next[dict->lru_prev[id]] = dict->lru_next[id];
+  else
+    dict->lru_head = dict->lru_next[id];
+
+  if (dict->lru_next[id] >= 0)
+    dict->lru_prev[dict->lru_next[id]] = dict->lru_prev[id];
+  else
+    dict->lru_tail = dict->lru_prev[id];
+}
+
+/*
+ * Append a phrase to least recently used list (= most recently used phrase).
+ */
+static inline void lz78_dict_lru_append(struct lz78_dict_t *dict, int id)
+{
+  dict->lru_prev[id] = dict->lru_tail;
+  dict->lru_next[id] = -1;
+
+  if (dict->lru_tail >= 0)
+    dict->lru_next[dict->lru_tail] = id;
+  else
+    dict->lru_head = id;
+
+  dict->lru_tail = id;
+}
+
+/*
+ * Mark a phrase as used.
+ */
+static inline void lz78_dict_touch(struct lz78_dict_t *dict, int id)
+{
+  if (dict->policy == LZ78_POLICY_PRUNE && id >= dict->first_id && dict->nb_children[id] == 0) {
+    lz78_dict_lru_remove(dict, id);
+    lz78_dict_lru_append(dict, id);
+  }
+}
+
+/*
+ * Get id of a new phrase (child of parent) : next free id, else apply dictionnary policy.
+ * Returns -1 if no phrase can be added.
+ */
+static int lz78_dict_next_id(struct lz78_dict_t *dict, int parent)
+{
+  int id, p;
+
+  /* free id */
+  if (!dict->max_size || dict->next_id < dict->max_size) {
+    if (dict->next_id >= dict->size)
+      lz78_dict_grow(dict, dict->max_size && 2 * dict->size > dict->max_size ? dict->max_size : 2 * dict->size);
+
+    return dict->next_id++;
+  }
+
+  /* reset : start again with root and characters */
+  if (dict->policy == LZ78_POLICY_RESET) {
+    dict->next_id = dict->first_id;
+    if (dict->hash.keys) {
+      memset(dict->hash.keys, 0xFF, sizeof(uint64_t) << dict->hash.bits);
+      dict->hash.nb_entries = 0;
+    }
+
+    return -1;
+  }
+
+  /* freeze */
+  if (dict->policy != LZ78_POLICY_PRUNE)
+    return -1;
+
+  /* prune : replace least recently used phrase without children (unless it is the parent) */
+  id = dict->lru_head;
+  if (id < 0 || id == parent)
+    return -1;
+
+  lz78_dict_lru_remove(dict, id);
+  p = dict->parent[id];
+  if (dict->hash.keys)
+    lz78_hash_remove(&dict->hash, p, dict->c[id]);
+  if (--dict->nb_children[p] == 0 && p >= dict->first_id)
+    lz78_dict_lru_append(dict, p);
+
+  return id;
+}
+
+/*
+ * Add a phrase (id given by lz78_dict_next_id, offset = output position of the phrase for the decoder).
+ */
+static void lz78_dict_add(struct lz78_dict_t *dict, int id, int parent, int c, long offset)
+{
+  dict->parent[id] = parent;
+  dict->c[id] = c;
+
+  if (dict->decoder) {
+    dict->len[id] = dict->len[parent] + 1;
+    dict->offset[id] = offset;
+  }
+
+  if (dict->hash.keys)
+    lz78_hash_insert(&dict->hash, parent, c, id);
+
+  if (dict->policy == LZ78_POLICY_PRUNE) {
+    dict->nb_children[id] = 0;
+    if (dict->nb_children[parent]++ == 0 && parent >= dict->first_id)
+      lz78_dict_lru_remove(dict, parent);
+    lz78_dict_lru_append(dict, id);
+  }
+}
+
+/*
+ * Init decoder output window.
+ */
+static void lz78_window_init(struct lz78_window_t *win, struct stream_t *output)
+{
+  win->output = output;
+  win->base = 0;
+  win->end = 0;
+  win->written = 0;
+  win->in_place = !output->fp && output->fd < 0;
+
+  if (win->in_place) {
+    win->buf = output->buf + output->pos;
+    win->size = output->size - output->pos;
+  } else {
+    win->size = LZ78_WINDOW_SIZE;
+    win->buf = (unsigned char *) xmalloc(win->size);
+  }
+}
+
+/*
+ * Make room for len characters : write pending characters and keep the last half of the window as history
+ * (window grows for a longer phrase). Returns -1 if memory output is full.
+ */
+static int lz78_window_reserve(struct lz78_window_t *win, long len)
+{
+  long keep;
+
+  if (win->end + len - win->base <= win->size)
+    return 0;
+
+  if (win->in_place) {
+    win->output->error = 1;
+    return -1;
+  }
+
+  /* write pending characters */
+  stream_write(win->output, win->buf + (win->written - win->base), win->end - win->written);
+  win->written = win->end;
+
+  /* keep history */
+  keep = win->end - win->base < win->size / 2 ? win->end - win->base : win->size / 2;
+  memmove(win->buf, win->buf + (win->end - keep - win->base), keep);
+  win->base = win->end - keep;
+
+  /* grow window */
+  if (keep + len > win->size) {
+    win->size = 2 * (keep + len);
+    win->buf = (unsigned char *) xrealloc(win->buf, win->size);
+  }
+
+  return 0;
+}
+
+/*
+ * Write a phrase in window (room must have been reserved) : copy its last occurrence if it is still in the window,
+ * else decode it from its last character.
+ */
+static inline void lz78_window_put_phrase(struct lz78_window_t *win, struct lz78_dict_t *dict, int id)
+{
+  unsigned char *dst = win->buf + (win->end - win->base);
+  long len = dict->len[id], i;
+  int p;
+
+  if (dict->offset[id] >= win->base)
+    memcpy(dst, win->buf + (dict->offset[id] - win->base), len);
+  else
+    for (i = len, p = id; i > 0; p = dict->parent[p])
+      dst[--i] = dict->c[p];
+
+  /* remember last occurrence */
+  dict->offset[id] = win->end;
+  win->end += len;
+}
+
+/*
+ * Write a character in window (room must have been reserved).
+ */
+static inline void lz78_window_putc(struct lz78_window_t *win, int c)
+{
+  win->buf[win->end++ - win->base] = c;
+}
+
+/*
+ * Close decoder output window : update memory output or write remaining characters.
+ */
+static void lz78_window_close(struct lz78_window_t *win, int ret)
+{
+  if (win->in_place) {
+    win->output->pos += win->end;
+    if (win->output->pos > win->output->len)
+      win->output->len = win->output->pos;
+  } else {
+    if (ret == 0)
+      stream_write(win->output, win->buf + (win->written - win->base), win->end - win->written);
+    free(win->buf);
+  }
+}
+
+/*
+ * Compress a stream with lz78 algorithm (pairs mode).
+ */
+static int lz78_compress_pairs(struct stream_t *input, struct stream_t *output, int max_size, int policy)
+{
+  int c, node, next, id, nb_ids = 0;
+  struct lz78_dict_t dict;
+  off_t nb_ids_pos;
+
+  /* write temporary number of ids (= root and phrases) */
+  nb_ids_pos = stream_tell(output);
+  stream_write(output, &nb_ids, sizeof(int));
+
+  /* create dictionnary (with root node) */
+  lz78_dict_init(&dict, LZ78_FIRST_ID, max_size, policy, 1);
+  nb_ids++;
+
+  for (node = LZ78_FIRST_ID - 1;;) {
     /* get next character */
-    c = fgetc(fp_input);
+    c = stream_getc(input);
 
-    /* find character in trie */
-    next = trie_find(node, c);
-    if (next) {
+    /* end of input : write pending phrase (the decoder drops the character of the last pair) */
+    if (c == EOF) {
+      stream_write(output, &node, sizeof(int));
+      stream_putc(output, c);
+      nb_ids++;
+      break;
+    }
+
+    /* find character in dictionnary */
+    next = lz78_hash_find(&dict.hash, node, c);
+    if (next >= 0) {
       node = next;
       continue;
     }
 
-    /* insert new character in trie */
-    trie_insert(node, c, id++);
-
     /* write compressed data */
-    fwrite(&node->id, sizeof(int), 1, fp_output);
-    fwrite(&c, sizeof(char), 1, fp_output);
+    stream_write(output, &node, sizeof(int));
+    stream_putc(output, c);
+    nb_ids++;
+
+    /* insert new phrase in dictionnary */
+    lz78_dict_touch(&dict, node);
+    id = lz78_dict_next_id(&dict, node);
+    if (id >= 0)
+      lz78_dict_add(&dict, id, node, c, -1);
 
     /* go back to root */
-    node = root;
+    node = LZ78_FIRST_ID - 1;
+  }
 
-    /* end of file */
-    if (c == EOF)
-      break;
+  /* write final number of ids */
+  stream_seek(output, nb_ids_pos);
+  stream_write(output, &nb_ids, sizeof(int));
+
+  /* free dictionnary */
+  lz78_dict_free(&dict);
+
+  return stream_error(output) ? -1 : 0;
+}
+
+/*
+ * Get width of lzw codes after a phrase has been added (codes < next id must fit, back to 9 bits after a reset).
+ */
+static inline int lz78_code_bits(struct lz78_dict_t *dict, int nb_bits)
+{
+  if (dict->next_id == LZW_FIRST_CODE)
+    return LZW_MIN_CODE_BITS;
+
+  return dict->next_id > (1 << nb_bits) ? nb_bits + 1 : nb_bits;
+}
+
+/*
+ * Compress a stream with lzw algorithm.
+ */
+static int lz78_compress_lzw(struct stream_t *input, struct stream_t *output, int max_size, int policy)
+{
+  int c, node, next, id, nb_bits = LZW_MIN_CODE_BITS;
+  unsigned char buf_output[IO_BUF_SIZE];
+  struct lz78_dict_t dict;
+  struct bit_writer_t bw;
+
+  /* create dictionnary */
+  lz78_dict_init(&dict, LZW_FIRST_CODE, max_size, policy, 1);
+
+  /* init bit writer */
+  bit_writer_init(&bw, output, buf_output, IO_BUF_SIZE);
+
+  /* first character */
+  node = stream_getc(input);
+
+  while (node != EOF) {
+    /* get next character */
+    c = stream_getc(input);
+
+    /* find character in dictionnary */
+    next = c == EOF ? -1 : lz78_hash_find(&dict.hash, node, c);
+    if (next >= 0) {
+      node = next;
+      continue;
+    }
+
+    /* write phrase */
+    bit_writer_put(&bw, node, nb_bits);
+
+    /* insert new phrase in dictionnary (only get its id at end of input, like the decoder) */
+    lz78_dict_touch(&dict, node);
+    id = lz78_dict_next_id(&dict, node);
+    if (id >= 0 && c != EOF)
+      lz78_dict_add(&dict, id, node, c, -1);
+    nb_bits = lz78_code_bits(&dict, nb_bits);
+
+    /* next phrase starts with current character */
+    node = c;
   }
 
-  /* write final dict size */
-  rewind(fp_output);
-  fwrite(&id, sizeof(int), 1, fp_output);
+  /* write stop code */
+  bit_writer_put(&bw, LZW_STOP_CODE, nb_bits);
+  bit_writer_flush(&bw);
+
+  /* free dictionnary */
+  lz78_dict_free(&dict);
+
+  return stream_error(output) ? -1 : 0;
+}
+
+/*
+ * Compress a stream with lz78 algorithm (options = NULL for default options).
+ */
+static int lz78_compress_data(struct stream_t *input, struct stream_t *output, const struct lz78_options_t *options)
+{
+  int mode, dict_bits, policy;
+
+  /* check options */
+  mode = options && options->mode ? options->mode : LZ78_MODE;
+  dict_bits = options && options->dict_bits ? options->dict_bits : LZ78_DICT_BITS;
+  policy = options && options->policy ? options->policy : LZ78_POLICY;
+  if ((mode != LZ78_MODE_PAIRS && mode != LZ78_MODE_LZW) || dict_bits < LZ78_MIN_DICT_BITS
+      || dict_bits > LZ78_MAX_DICT_BITS || policy < LZ78_POLICY_FREEZE || policy > LZ78_POLICY_PRUNE)
+    return -1;
+
+  /* write header */
+  stream_write(output, LZ78_MAGIC, LZ78_MAGIC_SIZE);
+  stream_putc(output, mode);
+  stream_putc(output, dict_bits);
+  stream_putc(output, policy);
+
+  if (mode == LZ78_MODE_LZW)
+    return lz78_compress_lzw(input, output, 1 << dict_bits, policy);
+
+  return lz78_compress_pairs(input, output, 1 << dict_bits, policy);
+}
+
+/*
+ * Uncompress a stream with lz78 algorithm (pairs mode, number of ids has already been read, max size = 0 for an
+ * unbounded dictionnary).
+ */
+static int lz78_uncompress_pairs(struct stream_t *input, struct stream_t *output, int nb_ids, int max_size,
+                                 int policy)
+{
+  int ret = -1, parent, c, id, n;
+  struct lz78_window_t win;
+  struct lz78_dict_t dict;
+  long start;
+
+  /* check number of ids */
+  if (nb_ids <= 0)
+    return -1;
+
+  /* create dictionnary (with root node) and output window */
+  lz78_dict_init(&dict, LZ78_FIRST_ID, max_size, policy, 0);
+  lz78_window_init(&win, output);
+
+  for (n = LZ78_FIRST_ID; n < nb_ids;) {
+    /* read lz78 pair */
+    if (stream_read(input, &parent, sizeof(int)) != sizeof(int) || (c = stream_getc(input)) == EOF)
+      goto out;
+
+    /* check parent */
+    if (parent < 0 || parent >= dict.next_id)
+      goto out;
+
+    /* decode parent phrase and next character (last pair = end of input marker) */
+    if (lz78_window_reserve(&win, dict.len[parent] + 1L))
+      goto out;
+    start = win.end;
+    lz78_window_put_phrase(&win, &dict, parent);
+    if (++n == nb_ids)
+      break;
+    lz78_window_putc(&win, c);
+
+    /* insert new phrase in dictionnary */
+    lz78_dict_touch(&dict, parent);
+    id = lz78_dict_next_id(&dict, parent);
+    if (id >= 0)
+      lz78_dict_add(&dict, id, parent, c, start);
+
+    if (stream_error(output))
+      goto out;
+  }
 
   ret = 0;
 out:
-  /* free dictionnary */
-  trie_free(root);
+  /* write remaining characters and free dictionnary */
+  lz78_window_close(&win, ret);
+  lz78_dict_free(&dict);
+
+  return stream_error(output) ? -1 : ret;
+}
+
+/*
+ * Uncompress a stream with lzw algorithm.
+ */
+static int lz78_uncompress_lzw(struct stream_t *input, struct stream_t *output, int max_size, int policy)
+{
+  int nb_bits = LZW_MIN_CODE_BITS, prev = -1, new_id, code, ret = -1;
+  unsigned char buf_input[BIT_IO_BUF_SIZE];
+  long start, prev_start = -1;
+  struct lz78_window_t win;
+  struct lz78_dict_t dict;
+  struct bit_reader_t br;
+
+  /* create dictionnary and output window */
+  lz78_dict_init(&dict, LZW_FIRST_CODE, max_size, policy, 0);
+  lz78_window_init(&win, output);
+
+  /* init bit reader (memory input is read in place) */
+  if (input->fp)
+    bit_reader_init(&br, input, buf_input, buf_input, 0);
+  else
+    bit_reader_init(&br, NULL, NULL, input->buf + input->pos, input->len - input->pos);
+
+  for (;;) {
+    /* encoder added a phrase after previous code (= previous phrase + first character of this one) */
+    new_id = -1;
+    if (prev >= 0) {
+      new_id = lz78_dict_next_id(&dict, prev);
+      nb_bits = lz78_code_bits(&dict, nb_bits);
+    }
+
+    /* read next code (end of input is padded with zeros : a missing stop code is an error) */
+    if (br.nb_bits < nb_bits)
+      bit_reader_refill(&br);
+    code = bit_reader_get(&br, nb_bits);
+    if (code == LZW_STOP_CODE) {
+      ret = 0;
+      break;
+    }
+
+    /* check code */
+    if (code >= dict.next_id)
+      break;
+
+    /* decode phrase (new phrase isn't in dictionnary yet : it is previous phrase + its first character) */
+    if (lz78_window_reserve(&win, code == new_id ? dict.len[prev] + 1L : dict.len[code]))
+      break;
+    start = win.end;
+    if (code == new_id) {
+      lz78_window_put_phrase(&win, &dict, prev);
+      lz78_window_putc(&win, win.buf[start - win.base]);
+    } else {
+      lz78_window_put_phrase(&win, &dict, code);
+    }
+
+    /* add new phrase (previous phrase is followed by first character of this one in output) */
+    if (new_id >= 0)
+      lz78_dict_add(&dict, new_id, prev, win.buf[start - win.base], prev_start);
+    lz78_dict_touch(&dict, code);
+
+    if (stream_error(output))
+      break;
+
+    prev = code;
+    prev_start = start;
+  }
+
+  /* write remaining characters and free dictionnary */
+  lz78_window_close(&win, ret);
+  lz78_dict_free(&dict);
+
+  return stream_error(output) ? -1 : ret;
+}
+
+/*
+ * Uncompress a stream with lz78 algorithm (any format).
+ */
+static int lz78_uncompress_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char magic[LZ78_MAGIC_SIZE];
+  int mode, dict_bits, policy, nb_ids;
+
+  /* read magic */
+  if (stream_read(input, magic, LZ78_MAGIC_SIZE) != LZ78_MAGIC_SIZE)
+    return -1;
+
+  /* old stream without header : magic is number of ids */
+  if (memcmp(magic, LZ78_MAGIC, LZ78_MAGIC_SIZE) != 0) {
+    memcpy(&nb_ids, magic, sizeof(int));
+    return lz78_uncompress_pairs(input, output, nb_ids, 0, LZ78_POLICY_FREEZE);
+  }
+
+  /* read and check header */
+  mode = stream_getc(input);
+  dict_bits = stream_getc(input);
+  policy = stream_getc(input);
+  if (dict_bits < LZ78_MIN_DICT_BITS || dict_bits > LZ78_MAX_DICT_BITS || policy < LZ78_POLICY_FREEZE
+      || policy > LZ78_POLICY_PRUNE)
+    return -1;
+
+  if (mode == LZ78_MODE_LZW)
+    return lz78_uncompress_lzw(input, output, 1 << dict_bits, policy);
+
+  /* pairs mode */
+  if (mode != LZ78_MODE_PAIRS || stream_read(input, &nb_ids, sizeof(int)) != sizeof(int))
+    return -1;
+
+  return lz78_uncompress_pairs(input, output, nb_ids, 1 << dict_bits, policy);
+}
+
+/*
+ * Compress a file with lz78 algorithm (options = NULL for default options).
+ */
+int lz78_compress_options(const char *input_file, const char *output_file, const struct lz78_options_t *options)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* compress file */
+  ret = lz78_compress_data(&input, &output, options);
 
   /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
 
   return ret;
 }
 
+/*
+ * Compress a file with lz78 algorithm.
+ */
+int lz78_compress(const char *input_file, const char *output_file)
+{
+  return lz78_compress_options(input_file, output_file, NULL);
+}
+
 /*
  * Uncompress a file with lz78 algorithm.
  */
 int lz78_uncompress(const char *input_file, const char *output_file)
 {
-  struct trie_t *root = NULL, **dict = NULL, *parent, *node;
-  int ret, dict_size, id = 0, parent_id, i;
-  unsigned char c, buffer[1024];
-  FILE *fp_input, *fp_output;
+  struct stream_t input, output;
+  int ret;
 
   /* open input file */
-  fp_input = fopen(input_file, "r");
-  if (!fp_input)
-    return errno;
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
 
   /* open output file */
-  fp_output = fopen(output_file, "w");
-  if (!fp_output) {
-    ret = errno;
-    fclose(fp_input);
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
     return ret;
   }
 
-  /* get dict size */
-  if (fread(&dict_size, sizeof(int), 1, fp_input) != 1) {
-    ret = -1;
-    goto out;
-  }
-
-  /* create dict */
-  dict = (struct trie_t **) xmalloc(sizeof(struct trie_t *) * dict_size);
-  for (i = 0; i < dict_size; i++)
-    dict[i] = NULL;
+  /* uncompress file */
+  ret = lz78_uncompress_data(&input, &output);
 
-  /* insert root node */
-  root = dict[0] = trie_insert(root, 0, id++);
-  if (!root) {
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
     ret = -1;
-    goto out;
-  }
-
-  for (;;) {
-    /* read lz78 pair */
-    if (fread(&parent_id, sizeof(int), 1, fp_input) != 1)
-      break;
-    fread(&c, sizeof(char), 1, fp_input);
 
-    /* get parent */
-    parent = dict[parent_id];
+  return ret;
+}
 
-    /* insert new node */
-    trie_insert(parent, c, id++);
-    node = trie_find(parent, c);
-    dict[node->id] = node;
+/*
+ * Maximum size of a lz78 compressed buffer (= header + dict size + one pair per character + end of input pair,
+ * lzw codes are smaller than pairs).
+ */
+size_t lz78_compress_bound(size_t len)
+{
+  return LZ78_HEADER_SIZE + sizeof(int) + (len + 1) * (sizeof(int) + sizeof(char));
+}
 
-    /* decode dict entry */
-    for (node = parent, i = 0; node->parent != NULL; node = node->parent, i++)
-      buffer[i] = node->c;
+/*
+ * Compress a buffer with lz78 algorithm (lz78_compress_bound(src_len) bytes are always enough).
+ */
+int lz78_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                         size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
 
-    /* write decoded string */
-    for (i = i - 1; i >= 0; i--)
-      fwrite(&buffer[i], sizeof(char), 1, fp_output);
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lz78_compress_data(&input, &output, NULL);
+  *dst_len = output.len;
 
-    /* write next character */
-    if (c != (unsigned char) EOF)
-      fwrite(&c, sizeof(char), 1, fp_output);
-  }
+  return ret;
+}
 
-  ret = 0;
-out:
-  /* free dictionnary */
-  xfree(dict);
-  trie_free(root);
+/*
+ * Uncompress a buffer with lz78 algorithm (fails if uncompressed data doesn't fit in dst_size bytes).
+ */
+int lz78_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                           size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
 
-  /* close files */
-  fclose(fp_input);
-  fclose(fp_output);
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lz78_uncompress_data(&input, &output);
+  *dst_len = output.len;
 
   return ret;
 }
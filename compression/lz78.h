@@ -1,7 +1,51 @@
 #ifndef _LZ78_H_
 #define _LZ78_H_
 
+#include <stdio.h>
+
+/*
+ * Modes :
+ * - pairs = every phrase is written as parent id (4 bytes) and next character
+ * - lzw = every phrase is written as a variable width code (9 bits first), next character is implicit
+ */
+#define LZ78_MODE_PAIRS     1
+#define LZ78_MODE_LZW       2
+#define LZ78_MODE           LZ78_MODE_LZW
+
+/*
+ * Maximum dictionnary size = 1 << dict bits phrases (default, min and max).
+ */
+#define LZ78_DICT_BITS      16
+#define LZ78_MIN_DICT_BITS  9
+#define LZ78_MAX_DICT_BITS  24
+
+/*
+ * Policies when dictionnary is full :
+ * - freeze = keep it as is
+ * - reset = start again with an empty dictionnary
+ * - prune = replace least recently used phrase (among phrases without children)
+ */
+#define LZ78_POLICY_FREEZE  1
+#define LZ78_POLICY_RESET   2
+#define LZ78_POLICY_PRUNE   3
+#define LZ78_POLICY         LZ78_POLICY_PRUNE
+
+/*
+ * Compression options (0 = default value).
+ */
+struct lz78_options_t {
+  int mode;
+  int dict_bits;
+  int policy;
+};
+
 int lz78_compress(const char *input_file, const char *output_file);
+int lz78_compress_options(const char *input_file, const char *output_file, const struct lz78_options_t *options);
 int lz78_uncompress(const char *input_file, const char *output_file);
+int lz78_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                         size_t *dst_len);
+int lz78_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                           size_t *dst_len);
+size_t lz78_compress_bound(size_t len);
 
 #endif
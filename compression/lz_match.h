@@ -0,0 +1,77 @@
+#ifndef _LZ_MATCH_H_
+#define _LZ_MATCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Matches are copied by chunks of LZ_WILD_COPY_SIZE bytes.
+ */
+#define LZ_WILD_COPY_SIZE   16
+
+/*
+ * Get length of common prefix of "s" and "match" (at most max_len characters, match may overlap s).
+ * 8 bytes are compared at once : first different byte is given by trailing zeros of the xor (leading zeros
+ * on big endian).
+ */
+static inline int lz_match_length(const unsigned char *s, const unsigned char *match, int max_len)
+{
+  uint64_t a, b, diff;
+  int len;
+
+  for (len = 0; len + 8 <= max_len; len += 8) {
+    memcpy(&a, s + len, sizeof(uint64_t));
+    memcpy(&b, match + len, sizeof(uint64_t));
+    diff = a ^ b;
+    if (diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      return len + (__builtin_ctzll(diff) >> 3);
+#else
+      return len + (__builtin_clzll(diff) >> 3);
+#endif
+    }
+  }
+
+  /* last characters */
+  for (; len < max_len && s[len] == match[len]; len++);
+
+  return len;
+}
+
+/*
+ * Copy a match of len characters from src to dst (len > 0, src = dst - offset if they overlap). Up to
+ * LZ_WILD_COPY_SIZE - 1 characters after dst + len may be overwritten.
+ */
+static inline void lz_copy_match(unsigned char *dst, const unsigned char *src, long len)
+{
+  unsigned char *end = dst + len;
+  long dist = dst - src;
+
+  /* no overlap within 16 bytes (or src after dst in circular buffer) */
+  if (dist >= LZ_WILD_COPY_SIZE || dist < 0) {
+    do {
+      memcpy(dst, src, LZ_WILD_COPY_SIZE);
+      dst += LZ_WILD_COPY_SIZE;
+      src += LZ_WILD_COPY_SIZE;
+    } while (dst < end);
+    return;
+  }
+
+  /* run of a single character */
+  if (dist == 1) {
+    memset(dst, *src, len);
+    return;
+  }
+
+  /* short pattern : repeat it until distance is at least 8 (a multiple of offset is still a valid distance) */
+  for (; dist < 8 && dst < end; dist *= 2) {
+    memcpy(dst, src, dist);
+    dst += dist;
+  }
+
+  for (; dst < end; dst += 8)
+    memcpy(dst, dst - dist, 8);
+}
+
+#endif
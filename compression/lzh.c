@@ -0,0 +1,591 @@
+/*
+ * LZH = LZ77 + huffman coding (deflate like).
+ * 1 - parse input in lz77 tokens (pattern length, pattern offset, next character) with the lz77 match finder
+ * 2 - group tokens in blocks, and compute huffman codes of every block for 2 alphabets :
+ *     -> literals/lengths = 256 characters + pattern lengths
+ *     -> distances = pattern offsets
+ *     lengths and offsets are coded by buckets (range of values), low bits of the value follow as extra bits
+ * 3 - write every block with its code lengths (so decompressor will be able to rebuild the same codes), then
+ *     each token = length code + extra bits and distance code + extra bits if there is a pattern, then
+ *     literal code of next character
+ * 4 - if encoded block is not smaller than its characters, store characters instead
+ * Output = magic, window log and blocks (number of characters, encoded size and encoded block), until an empty
+ * block. A stored block has encoded size = number of characters. Patterns may reference characters of previous
+ * blocks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lzh.h"
+#include "lz77.h"
+#include "lz_match.h"
+#include "stream.h"
+#include "bitstream.h"
+#include "huffman_code.h"
+#include "../utils/mem.h"
+
+#define LZH_MAGIC                 "LZHC"
+#define LZH_MAGIC_SIZE            4
+#define LZH_HEADER_SIZE           ((LZH_MAGIC_SIZE) + 1)
+
+/*
+ * Buckets : values below LZH_NB_DIRECT have their own code, larger values are split by their highest bit and
+ * the bit after it (2 codes per power of 2). Lengths - 1 (< 1 << 16) use 40 codes, offsets - 1
+ * (< 1 << LZ77_MAX_WINDOW_LOG) use 56 codes.
+ */
+#define LZH_NB_DIRECT             16
+#define LZH_NB_LITERALS           256
+#define LZH_NB_LENGTHS            40
+#define LZH_NB_LITLEN             ((LZH_NB_LITERALS) + (LZH_NB_LENGTHS))
+#define LZH_NB_DISTANCES          56
+
+#define lzh_extra_bits(code)      ((code) < LZH_NB_DIRECT ? 0 : ((code) - LZH_NB_DIRECT) / 2 + 3)
+
+/*
+ * A block holds at most LZH_BLOCK_TOKENS tokens (and LZH_BLOCK_SIZE characters).
+ */
+#define LZH_BLOCK_TOKENS          (32 * 1024)
+
+/*
+ * Block header = code lengths of both alphabets (4 bits each, a zero length is followed by the number of
+ * next zero lengths on 5 bits).
+ */
+#define LZH_MAX_ZERO_RUN          31
+#define LZH_LENGTHS_SIZE          ((((LZH_NB_LITLEN) + (LZH_NB_DISTANCES)) * 9 + 7) / 8)
+
+/*
+ * Maximum size of an encoded block : a token costs at most 3 codes and extra bits of a length and an offset.
+ */
+#define LZH_MAX_TOKEN_BITS        (3 * HUFF_MAX_CODE_LENGTH + lzh_extra_bits(LZH_NB_LENGTHS - 1) \
+                                   + lzh_extra_bits(LZH_NB_DISTANCES - 1))
+#define lzh_block_bound(nb_tokens)  (LZH_LENGTHS_SIZE + ((nb_tokens) * LZH_MAX_TOKEN_BITS + 7) / 8 + 8)
+
+/*
+ * Token of a block.
+ */
+struct lzh_token_t {
+  uint32_t offset;
+  uint16_t len;
+  unsigned char c;
+};
+
+/*
+ * Encoder = tokens of current block, their characters (len = number of characters) and frequencies of
+ * their codes.
+ */
+struct lzh_encoder_t {
+  struct stream_t *output;
+  struct lzh_token_t *tokens;
+  size_t nb_tokens;
+  unsigned char *chars;
+  uint32_t len;
+  size_t lit_freq[LZH_NB_LITLEN];
+  size_t dist_freq[LZH_NB_DISTANCES];
+  unsigned char *buf;
+};
+
+/*
+ * Decoder output = buffer of size characters (circular buffer if mask != -1, with slack after its end).
+ */
+struct lzh_decoder_t {
+  unsigned char *out;
+  long size;
+  long mask;
+  long limit;
+  long window;
+};
+
+/*
+ * Get bucket code of a value.
+ */
+static inline int lzh_code(uint32_t value)
+{
+  int n;
+
+  if (value < LZH_NB_DIRECT)
+    return value;
+
+  n = 31 - __builtin_clz(value);
+  return LZH_NB_DIRECT + 2 * (n - 4) + ((value >> (n - 1)) & 1);
+}
+
+/*
+ * Write a value = code of its bucket and extra bits.
+ */
+static inline void lzh_write_value(struct bit_writer_t *bw, uint32_t *codes, int *lengths, uint32_t value)
+{
+  int code = lzh_code(value), extra = lzh_extra_bits(code);
+
+  bit_writer_put(bw, codes[code], lengths[code]);
+  bit_writer_put(bw, value & ((1U << extra) - 1), extra);
+}
+
+/*
+ * Read a value (code of its bucket has already been read).
+ */
+static inline uint32_t lzh_read_value(struct bit_reader_t *br, int code)
+{
+  int extra;
+
+  if (code < LZH_NB_DIRECT)
+    return code;
+
+  extra = lzh_extra_bits(code);
+  if (br->nb_bits < extra)
+    bit_reader_refill(br);
+
+  return ((2U | (code & 1)) << extra) | bit_reader_get(br, extra);
+}
+
+/*
+ * Write code lengths of an alphabet.
+ */
+static void lzh_write_lengths(struct bit_writer_t *bw, int *lengths, size_t nb_symbols)
+{
+  size_t i;
+  int run;
+
+  for (i = 0; i < nb_symbols;) {
+    bit_writer_put(bw, lengths[i], 4);
+    if (lengths[i++])
+      continue;
+
+    /* run of zeros */
+    for (run = 0; run < LZH_MAX_ZERO_RUN && i < nb_symbols && !lengths[i]; run++, i++);
+    bit_writer_put(bw, run, 5);
+  }
+}
+
+/*
+ * Encode and write current block.
+ */
+static void lzh_write_block(struct lzh_encoder_t *encoder)
+{
+  int lit_lengths[LZH_NB_LITLEN], dist_lengths[LZH_NB_DISTANCES];
+  uint32_t lit_codes[LZH_NB_LITLEN], dist_codes[LZH_NB_DISTANCES], dst_len;
+  struct lzh_token_t *token;
+  struct bit_writer_t bw;
+  size_t i;
+
+  if (!encoder->nb_tokens)
+    return;
+
+  /* build codes (a block without patterns has no distance code) */
+  if (huffman_build_lengths(encoder->lit_freq, lit_lengths, LZH_NB_LITLEN, HUFF_MAX_CODE_LENGTH)) {
+    encoder->output->error = 1;
+    return;
+  }
+  huffman_build_lengths(encoder->dist_freq, dist_lengths, LZH_NB_DISTANCES, HUFF_MAX_CODE_LENGTH);
+  huffman_canonical_codes(lit_lengths, lit_codes, LZH_NB_LITLEN);
+  huffman_canonical_codes(dist_lengths, dist_codes, LZH_NB_DISTANCES);
+
+  /* write code lengths */
+  bit_writer_init(&bw, NULL, encoder->buf, lzh_block_bound(LZH_BLOCK_TOKENS));
+  lzh_write_lengths(&bw, lit_lengths, LZH_NB_LITLEN);
+  lzh_write_lengths(&bw, dist_lengths, LZH_NB_DISTANCES);
+
+  /* write tokens */
+  for (i = 0; i < encoder->nb_tokens; i++) {
+    token = &encoder->tokens[i];
+    if (token->len > 0) {
+      lzh_write_value(&bw, lit_codes + LZH_NB_LITERALS, lit_lengths + LZH_NB_LITERALS, token->len - 1);
+      lzh_write_value(&bw, dist_codes, dist_lengths, token->offset - 1);
+    }
+
+    bit_writer_put(&bw, lit_codes[token->c], lit_lengths[token->c]);
+  }
+  bit_writer_flush(&bw);
+
+  /* write block (or store its characters) */
+  dst_len = bw.pos < encoder->len ? bw.pos : encoder->len;
+  stream_write(encoder->output, &encoder->len, sizeof(uint32_t));
+  stream_write(encoder->output, &dst_len, sizeof(uint32_t));
+  stream_write(encoder->output, dst_len < encoder->len ? encoder->buf : encoder->chars, dst_len);
+
+  /* reset block */
+  encoder->nb_tokens = 0;
+  encoder->len = 0;
+  memset(encoder->lit_freq, 0, sizeof(encoder->lit_freq));
+  memset(encoder->dist_freq, 0, sizeof(encoder->dist_freq));
+}
+
+/*
+ * Add a token to current block (lz77 token handler).
+ */
+static void lzh_add_token(void *arg, const unsigned char *s, int len, long offset)
+{
+  struct lzh_encoder_t *encoder = (struct lzh_encoder_t *) arg;
+  struct lzh_token_t *token;
+
+  /* token doesn't fit in current block */
+  if (encoder->nb_tokens == LZH_BLOCK_TOKENS || encoder->len + len + 1 > LZH_BLOCK_SIZE)
+    lzh_write_block(encoder);
+
+  /* add token */
+  token = &encoder->tokens[encoder->nb_tokens++];
+  token->len = len;
+  token->offset = offset;
+  token->c = s[len];
+  memcpy(encoder->chars + encoder->len, s, len + 1);
+  encoder->len += len + 1;
+
+  /* update frequencies */
+  if (len > 0) {
+    encoder->lit_freq[LZH_NB_LITERALS + lzh_code(len - 1)]++;
+    encoder->dist_freq[lzh_code(offset - 1)]++;
+  }
+  encoder->lit_freq[token->c]++;
+}
+
+/*
+ * Compress a stream with lzh algorithm.
+ */
+static int lzh_compress_data(struct stream_t *input, struct stream_t *output, const struct lz77_options_t *options)
+{
+  struct lzh_encoder_t encoder;
+  uint32_t end = 0;
+  int window_log, ret;
+
+  /* get window */
+  window_log = lz77_window_log(input, options);
+  if (window_log < 0)
+    return -1;
+
+  /* write header */
+  stream_write(output, LZH_MAGIC, LZH_MAGIC_SIZE);
+  stream_putc(output, window_log);
+
+  /* create encoder */
+  memset(&encoder, 0, sizeof(struct lzh_encoder_t));
+  encoder.output = output;
+  encoder.tokens = (struct lzh_token_t *) xmalloc(sizeof(struct lzh_token_t) * LZH_BLOCK_TOKENS);
+  encoder.chars = (unsigned char *) xmalloc(LZH_BLOCK_SIZE);
+  encoder.buf = (unsigned char *) xmalloc(lzh_block_bound(LZH_BLOCK_TOKENS));
+
+  /* encode tokens, then last block and end of stream */
+  ret = lz77_parse(input, window_log, options, lzh_add_token, &encoder);
+  if (!ret) {
+    lzh_write_block(&encoder);
+    stream_write(output, &end, sizeof(uint32_t));
+  }
+
+  free(encoder.tokens);
+  free(encoder.chars);
+  free(encoder.buf);
+  return ret || stream_error(output) ? -1 : 0;
+}
+
+/*
+ * Read code lengths of an alphabet and build its decoding table.
+ */
+static int lzh_read_table(struct bit_reader_t *br, struct huff_table_t *table, size_t nb_symbols)
+{
+  int lengths[LZH_NB_LITLEN];
+  uint32_t codes[LZH_NB_LITLEN];
+  size_t i, run;
+
+  for (i = 0; i < nb_symbols;) {
+    if (br->nb_bits < 9)
+      bit_reader_refill(br);
+    lengths[i] = bit_reader_get(br, 4);
+    if (lengths[i++])
+      continue;
+
+    /* run of zeros */
+    run = bit_reader_get(br, 5);
+    if (run > nb_symbols - i)
+      return -1;
+    for (; run > 0; run--)
+      lengths[i++] = 0;
+  }
+
+  huffman_canonical_codes(lengths, codes, nb_symbols);
+  return huffman_table_build(table, codes, lengths, nb_symbols);
+}
+
+/*
+ * Decode a block of len characters at position end of output. Returns 0 on success, -1 on error.
+ */
+static int lzh_decode_block(struct lzh_decoder_t *decoder, const unsigned char *src, size_t src_len, long end,
+                            long len)
+{
+  struct huff_table_t lit_table = { NULL, 0, 0 }, dist_table = { NULL, 0, 0 };
+  unsigned char *out = decoder->out;
+  long block_end, dst, pos, length, offset, i;
+  struct bit_reader_t br;
+  int sym, ret = -1;
+
+  /* read code lengths */
+  bit_reader_init(&br, NULL, NULL, src, src_len);
+  if (lzh_read_table(&br, &lit_table, LZH_NB_LITLEN) || lzh_read_table(&br, &dist_table, LZH_NB_DISTANCES))
+    goto out;
+
+  for (block_end = end + len; end < block_end;) {
+    /* literal */
+    sym = huffman_decode_symbol(&br, &lit_table);
+    if (sym < LZH_NB_LITERALS) {
+      out[end & decoder->mask] = sym;
+      end++;
+      continue;
+    }
+
+    /* pattern */
+    length = lzh_read_value(&br, sym - LZH_NB_LITERALS) + 1;
+    offset = lzh_read_value(&br, huffman_decode_symbol(&br, &dist_table)) + 1;
+    if (offset > end || offset > decoder->window || length > block_end - end)
+      goto out;
+
+    /* copy pattern (fast copy if it doesn't wrap around circular buffer or reach end of output buffer) */
+    dst = end & decoder->mask;
+    pos = (end - offset) & decoder->mask;
+    if (dst + length + LZ_WILD_COPY_SIZE <= decoder->limit && pos + length <= decoder->size)
+      lz_copy_match(out + dst, out + pos, length);
+    else
+      for (i = 0; i < length; i++)
+        out[(dst + i) & decoder->mask] = out[(pos + i) & decoder->mask];
+
+    end += length;
+  }
+
+  ret = 0;
+out:
+  free(lit_table.entries);
+  free(dist_table.entries);
+  return ret;
+}
+
+/*
+ * Copy a stored block of len characters at position end of output.
+ */
+static void lzh_store_block(struct lzh_decoder_t *decoder, const unsigned char *src, long end, long len)
+{
+  long i = end & decoder->mask, n;
+
+  n = len < decoder->size - i ? len : decoder->size - i;
+  memcpy(decoder->out + i, src, n);
+  memcpy(decoder->out, src + n, len - n);
+}
+
+/*
+ * Write characters [from, to[ of a circular buffer.
+ */
+static void lzh_ring_write(struct stream_t *output, const unsigned char *ring, long ring_mask, long from, long to)
+{
+  long i = from & ring_mask;
+
+  if (i + (to - from) > ring_mask + 1) {
+    stream_write(output, ring + i, ring_mask + 1 - i);
+    from += ring_mask + 1 - i;
+    i = 0;
+  }
+
+  stream_write(output, ring + i, to - from);
+}
+
+/*
+ * Uncompress a stream with lzh algorithm.
+ */
+static int lzh_uncompress_data(struct stream_t *input, struct stream_t *output)
+{
+  unsigned char magic[LZH_MAGIC_SIZE], *buf_input = NULL;
+  struct lzh_decoder_t decoder;
+  const unsigned char *src;
+  uint32_t len, src_len;
+  int window_log, in_place, ret = -1;
+  long end;
+
+  /* read header */
+  if (stream_read(input, magic, LZH_MAGIC_SIZE) != LZH_MAGIC_SIZE || memcmp(magic, LZH_MAGIC, LZH_MAGIC_SIZE) != 0)
+    return -1;
+  window_log = stream_getc(input);
+  if (window_log < LZ77_MIN_WINDOW_LOG || window_log > LZ77_MAX_WINDOW_LOG)
+    return -1;
+  decoder.window = 1L << window_log;
+
+  /* memory output : decode in place, else decode in a circular buffer (= window + a block) */
+  in_place = !output->fp && output->fd < 0;
+  if (in_place) {
+    decoder.out = output->buf + output->pos;
+    decoder.size = output->size - output->pos;
+    decoder.mask = -1;
+    decoder.limit = decoder.size;
+  } else {
+    for (decoder.size = 1; decoder.size < decoder.window + LZH_BLOCK_SIZE + LZ_WILD_COPY_SIZE; decoder.size <<= 1);
+    decoder.mask = decoder.size - 1;
+    decoder.limit = decoder.size + LZ_WILD_COPY_SIZE;
+    decoder.out = (unsigned char *) xmalloc(decoder.limit);
+  }
+
+  /* file input : read blocks in a buffer, else decode them in place */
+  if (input->fp)
+    buf_input = (unsigned char *) xmalloc(LZH_BLOCK_SIZE);
+
+  for (end = 0; !stream_error(output);) {
+    /* read number of characters (empty block = end of stream) */
+    if (stream_read(input, &len, sizeof(uint32_t)) != sizeof(uint32_t))
+      break;
+    if (!len) {
+      ret = 0;
+      break;
+    }
+
+    /* read encoded block (never larger than its characters) */
+    if (len > LZH_BLOCK_SIZE || stream_read(input, &src_len, sizeof(uint32_t)) != sizeof(uint32_t)
+        || src_len > len)
+      break;
+    if (input->fp) {
+      if (stream_read(input, buf_input, src_len) != src_len)
+        break;
+      src = buf_input;
+    } else {
+      if (src_len > input->len - input->pos)
+        break;
+      src = input->buf + input->pos;
+      input->pos += src_len;
+    }
+
+    /* output buffer full */
+    if (in_place && end + (long) len > decoder.size) {
+      output->error = 1;
+      break;
+    }
+
+    /* decode block and write it */
+    if (src_len == len)
+      lzh_store_block(&decoder, src, end, len);
+    else if (lzh_decode_block(&decoder, src, src_len, end, len))
+      break;
+    if (!in_place)
+      lzh_ring_write(output, decoder.out, decoder.mask, end, end + len);
+    end += len;
+  }
+
+  /* update memory output */
+  if (in_place) {
+    output->pos += end;
+    if (output->pos > output->len)
+      output->len = output->pos;
+  } else {
+    free(decoder.out);
+  }
+
+  xfree(buf_input);
+  return stream_error(output) ? -1 : ret;
+}
+
+/*
+ * Compress a file with lzh algorithm (options = NULL for default options).
+ */
+int lzh_compress_options(const char *input_file, const char *output_file, const struct lz77_options_t *options)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* compress file */
+  ret = lzh_compress_data(&input, &output, options);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * Compress a file with lzh algorithm.
+ */
+int lzh_compress(const char *input_file, const char *output_file)
+{
+  return lzh_compress_options(input_file, output_file, NULL);
+}
+
+/*
+ * Uncompress a file with lzh algorithm.
+ */
+int lzh_uncompress(const char *input_file, const char *output_file)
+{
+  struct stream_t input, output;
+  int ret;
+
+  /* open input file */
+  ret = stream_open_input(&input, input_file);
+  if (ret)
+    return ret;
+
+  /* open output file */
+  ret = stream_open_output(&output, output_file);
+  if (ret) {
+    stream_close(&input);
+    return ret;
+  }
+
+  /* uncompress file */
+  ret = lzh_uncompress_data(&input, &output);
+
+  /* close files */
+  stream_close(&input);
+  if (stream_close(&output) && !ret)
+    ret = -1;
+
+  return ret;
+}
+
+/*
+ * Maximum size of a lzh compressed buffer (a block is never larger than its characters, and every block but
+ * the last one holds at least LZH_BLOCK_TOKENS characters).
+ */
+size_t lzh_compress_bound(size_t len)
+{
+  size_t nb_blocks = len / LZH_BLOCK_TOKENS + 1;
+
+  return LZH_HEADER_SIZE + sizeof(uint32_t) + nb_blocks * 2 * sizeof(uint32_t) + len;
+}
+
+/*
+ * Compress a buffer with lzh algorithm (lzh_compress_bound(src_len) bytes are always enough).
+ */
+int lzh_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                        size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lzh_compress_data(&input, &output, NULL);
+  *dst_len = output.len;
+
+  return ret;
+}
+
+/*
+ * Uncompress a buffer with lzh algorithm (fails if uncompressed data doesn't fit in dst_size bytes).
+ */
+int lzh_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len)
+{
+  struct stream_t input, output;
+  int ret;
+
+  stream_init_memory(&input, src, src_len, src_len);
+  stream_init_memory(&output, dst, 0, dst_size);
+  ret = lzh_uncompress_data(&input, &output);
+  *dst_len = output.len;
+
+  return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef _LZH_H_
+#define _LZH_H_
+
+#include <stdio.h>
+
+#include "lz77.h"
+
+/*
+ * Maximum number of characters encoded by a block.
+ */
+#define LZH_BLOCK_SIZE            (1024 * 1024)
+
+int lzh_compress(const char *input_file, const char *output_file);
+int lzh_compress_options(const char *input_file, const char *output_file, const struct lz77_options_t *options);
+int lzh_uncompress(const char *input_file, const char *output_file);
+int lzh_compress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                        size_t *dst_len);
+int lzh_uncompress_buffer(const unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_size,
+                          size_t *dst_len);
+size_t lzh_compress_bound(size_t len);
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "stream.h"
+#include "../utils/mem.h"
+
+/*
+ * Init a stream.
+ */
+static void stream_init(struct stream_t *stream, FILE *fp, int fd, unsigned char *buf, size_t len, size_t size)
+{
+  stream->fp = fp;
+  stream->fd = fd;
+  stream->mapped = 0;
+  stream->buf = buf;
+  stream->size = size;
+  stream->len = len;
+  stream->pos = 0;
+  stream->offset = 0;
+  stream->error = 0;
+}
+
+/*
+ * Init a stdio file stream.
+ */
+void stream_init_file(struct stream_t *stream, FILE *fp)
+{
+  stream_init(stream, fp, -1, NULL, 0, 0);
+}
+
+/*
+ * Init a memory stream (len = data length, size = buffer capacity).
+ */
+void stream_init_memory(struct stream_t *stream, const void *buf, size_t len, size_t size)
+{
+  stream_init(stream, NULL, -1, (unsigned char *) buf, len, size);
+}
+
+/*
+ * Open an input file. Regular files are memory mapped (and read as a memory stream), other files
+ * (pipes, empty files...) are read with stdio.
+ */
+int stream_open_input(struct stream_t *stream, const char *path)
+{
+  struct stat statbuf;
+  FILE *fp;
+  void *map;
+  int fd;
+
+  /* open input file */
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return errno;
+
+  /* map regular file */
+  if (fstat(fd, &statbuf) == 0 && S_ISREG(statbuf.st_mode) && statbuf.st_size > 0
+      && (uint64_t) statbuf.st_size <= SIZE_MAX) {
+    map = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      stream_init_memory(stream, map, statbuf.st_size, statbuf.st_size);
+      stream->mapped = 1;
+      return 0;
+    }
+  }
+
+  /* else use stdio */
+  fp = fdopen(fd, "r");
+  if (!fp) {
+    close(fd);
+    return errno;
+  }
+
+  stream_init_file(stream, fp);
+  return 0;
+}
+
+/*
+ * Open an output file (written by STREAM_BUF_SIZE chunks).
+ */
+int stream_open_output(struct stream_t *stream, const char *path)
+{
+  int fd;
+
+  /* open output file */
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    return errno;
+
+  stream_init(stream, NULL, fd, (unsigned char *) xmalloc(STREAM_BUF_SIZE), 0, STREAM_BUF_SIZE);
+  return 0;
+}
+
+/*
+ * Close a stream opened with stream_open_input() or stream_open_output(). Returns -1 if any error occured.
+ */
+int stream_close(struct stream_t *stream)
+{
+  int ret;
+
+  /* flush output buffer */
+  if (stream->fd >= 0)
+    stream_flush(stream);
+
+  ret = stream_error(stream) ? -1 : 0;
+
+  /* close input file */
+  if (stream->mapped)
+    munmap(stream->buf, stream->len);
+  else if (stream->fp)
+    fclose(stream->fp);
+
+  /* close output file */
+  if (stream->fd >= 0) {
+    if (close(stream->fd) != 0)
+      ret = -1;
+    free(stream->buf);
+  }
+
+  return ret;
+}
+
+/*
+ * Write data to output file.
+ */
+static int stream_write_fd(struct stream_t *stream, const unsigned char *buf, size_t len)
+{
+  ssize_t n;
+  size_t i;
+
+  for (i = 0; i < len; i += n) {
+    n = write(stream->fd, buf + i, len - i);
+    if (n < 0 && errno == EINTR) {
+      n = 0;
+    } else if (n <= 0) {
+      stream->error = 1;
+      return -1;
+    }
+  }
+
+  stream->offset += len;
+  return 0;
+}
+
+/*
+ * Write buffered data to output file (a full memory buffer is an error).
+ */
+int stream_flush(struct stream_t *stream)
+{
+  /* memory buffer overflow */
+  if (stream->fd < 0) {
+    stream->error = 1;
+    return -1;
+  }
+
+  /* write buffer */
+  if (stream_write_fd(stream, stream->buf, stream->len) != 0)
+    return -1;
+
+  /* empty buffer */
+  stream->pos = 0;
+  stream->len = 0;
+
+  return 0;
+}
+
+/*
+ * Read from a stream.
+ */
+size_t stream_read(struct stream_t *stream, void *buf, size_t len)
+{
+  if (stream->fp)
+    return fread(buf, 1, len, stream->fp);
+
+  /* read available data */
+  if (len > stream->len - stream->pos)
+    len = stream->len - stream->pos;
+
+  memcpy(buf, stream->buf + stream->pos, len);
+  stream->pos += len;
+
+  return len;
+}
+
+/*
+ * Write to a stream (writing past the end of a memory buffer is an error).
+ */
+size_t stream_write(struct stream_t *stream, const void *buf, size_t len)
+{
+  size_t n;
+
+  if (stream->fp)
+    return fwrite(buf, 1, len, stream->fp);
+
+  /* buffer full */
+  if (len > stream->size - stream->pos) {
+    /* memory buffer overflow : write what fits */
+    if (stream->fd < 0) {
+      n = stream->size - stream->pos;
+      memcpy(stream->buf + stream->pos, buf, n);
+      stream->pos = stream->len = stream->size;
+      stream->error = 1;
+      return n;
+    }
+
+    /* flush buffer */
+    if (stream_flush(stream) != 0)
+      return 0;
+
+    /* large write : bypass buffer */
+    if (len >= stream->size)
+      return stream_write_fd(stream, buf, len) == 0 ? len : 0;
+  }
+
+  memcpy(stream->buf + stream->pos, buf, len);
+  stream->pos += len;
+  if (stream->pos > stream->len)
+    stream->len = stream->pos;
+
+  return len;
+}
+
+/*
+ * Set stream position.
+ */
+int stream_seek(struct stream_t *stream, off_t offset)
+{
+  if (stream->fp)
+    return fseeko(stream->fp, offset, SEEK_SET);
+
+  /* output file : flush buffer and move file offset */
+  if (stream->fd >= 0) {
+    if (stream_flush(stream) != 0 || lseek(stream->fd, offset, SEEK_SET) < 0)
+      return -1;
+
+    stream->offset = offset;
+    return 0;
+  }
+
+  if (offset < 0 || (size_t) offset > stream->len)
+    return -1;
+
+  stream->pos = offset;
+  return 0;
+}
+
+/*
+ * Get stream position.
+ */
+off_t stream_tell(struct stream_t *stream)
+{
+  if (stream->fp)
+    return ftello(stream->fp);
+
+  return stream->offset + stream->pos;
+}
+
+/*
+ * Get stream size (-1 if the stream is not seekable).
+ */
+off_t stream_size(struct stream_t *stream)
+{
+  off_t pos, size;
+
+  if (stream->fd >= 0)
+    return -1;
+
+  if (!stream->fp)
+    return stream->len;
+
+  /* seek to end of file */
+  pos = ftello(stream->fp);
+  if (pos < 0 || fseeko(stream->fp, 0, SEEK_END) != 0)
+    return -1;
+
+  /* get size and go back */
+  size = ftello(stream->fp);
+  if (fseeko(stream->fp, pos, SEEK_SET) != 0)
+    return -1;
+
+  return size;
+}
+
+/*
+ * Read an array of nb items in a new buffer (count usually comes from a header : it is checked against remaining
+ * input of a memory stream, and buffer only grows as data is actually read from a file). Returns NULL on short read.
+ */
+void *stream_read_array(struct stream_t *stream, size_t nb, size_t item_size)
+{
+  unsigned char *buf;
+  size_t len, n, chunk;
+
+  /* too many items */
+  if (item_size && nb > SIZE_MAX / item_size)
+    return NULL;
+  len = nb * item_size;
+  if (!stream->fp && len > stream->len - stream->pos)
+    return NULL;
+
+  /* read by chunks */
+  buf = (unsigned char *) xmalloc(len < STREAM_BUF_SIZE ? len + 1 : STREAM_BUF_SIZE);
+  for (n = 0; n < len; n += chunk) {
+    chunk = len - n < STREAM_BUF_SIZE ? len - n : STREAM_BUF_SIZE;
+    if (n > 0)
+      buf = (unsigned char *) xrealloc(buf, n + chunk);
+
+    if (stream_read(stream, buf + n, chunk) != chunk) {
+      xfree(buf);
+      return NULL;
+    }
+  }
+
+  return buf;
+}
+
+/*
+ * Check stream error.
+ */
+int stream_error(struct stream_t *stream)
+{
+  if (stream->fp)
+    return ferror(stream->fp);
+
+  return stream->error;
+}
@@ -0,0 +1,71 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Size of the output buffer of a file stream and of stream read chunks.
+ */
+#define STREAM_BUF_SIZE           (1024 * 1024)
+
+/*
+ * Codec input/output : a stdio file, a memory buffer, a memory mapped input file or a buffered output file.
+ */
+struct stream_t {
+  FILE *fp;
+  int fd;
+  int mapped;
+  unsigned char *buf;
+  size_t size;
+  size_t len;
+  size_t pos;
+  off_t offset;
+  int error;
+};
+
+void stream_init_file(struct stream_t *stream, FILE *fp);
+void stream_init_memory(struct stream_t *stream, const void *buf, size_t len, size_t size);
+int stream_open_input(struct stream_t *stream, const char *path);
+int stream_open_output(struct stream_t *stream, const char *path);
+int stream_close(struct stream_t *stream);
+int stream_flush(struct stream_t *stream);
+size_t stream_read(struct stream_t *stream, void *buf, size_t len);
+size_t stream_write(struct stream_t *stream, const void *buf, size_t len);
+int stream_seek(struct stream_t *stream, off_t offset);
+off_t stream_tell(struct stream_t *stream);
+off_t stream_size(struct stream_t *stream);
+void *stream_read_array(struct stream_t *stream, size_t nb, size_t item_size);
+int stream_error(struct stream_t *stream);
+
+/*
+ * Read a character (EOF at end of stream).
+ */
+static inline int stream_getc(struct stream_t *stream)
+{
+  if (stream->fp)
+    return fgetc(stream->fp);
+
+  return stream->pos < stream->len ? stream->buf[stream->pos++] : EOF;
+}
+
+/*
+ * Write a character.
+ */
+static inline int stream_putc(struct stream_t *stream, int c)
+{
+  if (stream->fp)
+    return fputc(c, stream->fp);
+
+  /* buffer full : flush it to output file (fails for a memory buffer) */
+  if (stream->pos >= stream->size && stream_flush(stream) != 0)
+    return EOF;
+
+  stream->buf[stream->pos++] = c;
+  if (stream->pos > stream->len)
+    stream->len = stream->pos;
+
+  return (unsigned char) c;
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Suffix array built by prefix doubling :
+ * 1 - sort suffixes by their first character (= classes of suffixes sharing a prefix of length 1)
+ * 2 - knowing the classes of prefixes of length k, suffixes are ordered by the pair (class of the suffix, class of
+ *     the suffix starting k characters later) with 2 counting sorts (second key, then stable sort on first key)
+ *     -> classes of prefixes of length 2k
+ * 3 - repeat until every class holds a single suffix or prefix length reaches maximum depth (suffixes of a class
+ *     are then sorted by position)
+ * Every round is linear : construction is O(n log n).
+ * Longest common prefixes are then computed in linear time (Kasai) : going from suffix i to suffix i + 1
+ * loses at most one character of common prefix with the previous suffix. This doesn't hold if suffixes are
+ * only sorted up to a maximum depth : they are then compared directly (up to maximum depth).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "suffix_array.h"
+#include "../utils/mem.h"
+
+/*
+ * Class of the suffix starting k characters after suffix i (0 = no suffix, else class + 1).
+ */
+#define suffix_class_next(cls, i, k, len)   ((i) + (k) < (len) ? (cls)[(i) + (k)] + 1 : 0)
+
+/*
+ * Sort suffixes (rank is used to store the class of every suffix while sorting).
+ */
+static void suffix_array_sort(const unsigned char *text, uint32_t *sa, uint32_t *rank, size_t len,
+                              size_t max_depth)
+{
+  uint32_t count[256 + 1], *cls = rank, *tmp, *cnt, *next_cls;
+  size_t i, k, n, nb_classes;
+
+  if (!len)
+    return;
+
+  /* sort suffixes by first character */
+  memset(count, 0, sizeof(count));
+  for (i = 0; i < len; i++)
+    count[text[i] + 1]++;
+  for (i = 1; i <= 256; i++)
+    count[i] += count[i - 1];
+  for (i = 0; i < len; i++)
+    sa[count[text[i]]++] = i;
+
+  /* set classes */
+  cls[sa[0]] = 0;
+  for (i = 1, nb_classes = 1; i < len; i++) {
+    if (text[sa[i]] != text[sa[i - 1]])
+      nb_classes++;
+    cls[sa[i]] = nb_classes - 1;
+  }
+
+  /* double prefix length until all classes hold a single suffix */
+  tmp = (uint32_t *) xmalloc(sizeof(uint32_t) * len);
+  cnt = (uint32_t *) xmalloc(sizeof(uint32_t) * (len + 1));
+  next_cls = (uint32_t *) xmalloc(sizeof(uint32_t) * len);
+  for (k = 1; nb_classes < len && (!max_depth || k < max_depth); k *= 2) {
+    /* order by second key : suffixes without a suffix k characters later first, then order of that suffix */
+    for (i = len - k, n = 0; i < len; i++)
+      tmp[n++] = i;
+    for (i = 0; i < len; i++)
+      if (sa[i] >= k)
+        tmp[n++] = sa[i] - k;
+
+    /* stable counting sort on first key */
+    memset(cnt, 0, sizeof(uint32_t) * (nb_classes + 1));
+    for (i = 0; i < len; i++)
+      cnt[cls[i] + 1]++;
+    for (i = 1; i <= nb_classes; i++)
+      cnt[i] += cnt[i - 1];
+    for (i = 0; i < len; i++)
+      sa[cnt[cls[tmp[i]]]++] = tmp[i];
+
+    /* new classes */
+    next_cls[sa[0]] = 0;
+    for (i = 1, nb_classes = 1; i < len; i++) {
+      if (cls[sa[i]] != cls[sa[i - 1]]
+          || suffix_class_next(cls, sa[i], k, len) != suffix_class_next(cls, sa[i - 1], k, len))
+        nb_classes++;
+      next_cls[sa[i]] = nb_classes - 1;
+    }
+    memcpy(cls, next_cls, sizeof(uint32_t) * len);
+  }
+
+  /* maximum depth reached : sort suffixes of every class by position (stable counting sort in position order) */
+  if (nb_classes < len) {
+    memset(cnt, 0, sizeof(uint32_t) * (nb_classes + 1));
+    for (i = 0; i < len; i++)
+      cnt[cls[i] + 1]++;
+    for (i = 1; i <= nb_classes; i++)
+      cnt[i] += cnt[i - 1];
+    for (i = 0; i < len; i++)
+      sa[cnt[cls[i]]++] = i;
+  }
+
+  /* rank of every suffix */
+  for (i = 0; i < len; i++)
+    rank[sa[i]] = i;
+
+  free(tmp);
+  free(cnt);
+  free(next_cls);
+}
+
+/*
+ * Compute longest common prefixes up to max_depth characters.
+ */
+static void suffix_array_lcp_depth(const unsigned char *text, struct suffix_array_t *sa, size_t max_depth)
+{
+  size_t i, j, h, max_len;
+
+  sa->lcp[0] = 0;
+  for (i = 1; i < sa->len; i++) {
+    j = sa->sa[i - 1] > sa->sa[i] ? sa->sa[i - 1] : sa->sa[i];
+    max_len = sa->len - j < max_depth ? sa->len - j : max_depth;
+    for (h = 0; h < max_len && text[sa->sa[i - 1] + h] == text[sa->sa[i] + h]; h++);
+    sa->lcp[i] = h;
+  }
+}
+
+/*
+ * Compute longest common prefixes.
+ */
+static void suffix_array_lcp(const unsigned char *text, struct suffix_array_t *sa)
+{
+  size_t i, j, h;
+
+  for (i = 0, h = 0; i < sa->len; i++) {
+    if (sa->rank[i] == 0) {
+      sa->lcp[0] = 0;
+      h = 0;
+      continue;
+    }
+
+    j = sa->sa[sa->rank[i] - 1];
+    for (; i + h < sa->len && j + h < sa->len && text[i + h] == text[j + h]; h++);
+    sa->lcp[sa->rank[i]] = h;
+
+    if (h > 0)
+      h--;
+  }
+}
+
+/*
+ * Create a suffix array of a text (max_depth = 0 to sort suffixes completely).
+ */
+struct suffix_array_t *suffix_array_create(const unsigned char *text, size_t len, size_t max_depth)
+{
+  struct suffix_array_t *sa;
+  size_t depth;
+
+  /* positions are stored on 32 bits */
+  if (len > UINT32_MAX)
+    return NULL;
+
+  /* prefixes are doubled : round maximum depth up to a power of 2 */
+  for (depth = max_depth ? 1 : 0; depth && depth < max_depth; depth *= 2);
+
+  sa = (struct suffix_array_t *) xmalloc(sizeof(struct suffix_array_t));
+  sa->len = len;
+  sa->sa = (uint32_t *) xmalloc(sizeof(uint32_t) * (len + 1));
+  sa->rank = (uint32_t *) xmalloc(sizeof(uint32_t) * (len + 1));
+  sa->lcp = (uint32_t *) xmalloc(sizeof(uint32_t) * (len + 1));
+
+  suffix_array_sort(text, sa->sa, sa->rank, len, depth);
+  if (depth)
+    suffix_array_lcp_depth(text, sa, depth);
+  else
+    suffix_array_lcp(text, sa);
+
+  return sa;
+}
+
+/*
+ * Free a suffix array.
+ */
+void suffix_array_free(struct suffix_array_t *sa)
+{
+  if (sa) {
+    xfree(sa->sa);
+    xfree(sa->rank);
+    xfree(sa->lcp);
+    free(sa);
+  }
+}
@@ -0,0 +1,24 @@
+#ifndef _SUFFIX_ARRAY_H_
+#define _SUFFIX_ARRAY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Suffix array of a text = start positions of its suffixes in lexicographic order (sa), rank of every suffix
+ * (rank[sa[i]] = i) and longest common prefix of every suffix with the previous one (lcp[i] = length of common
+ * prefix of suffixes sa[i - 1] and sa[i], lcp[0] = 0).
+ * With a maximum depth (0 = none, rounded up to a power of 2), suffixes are only sorted on their first max_depth
+ * characters (suffixes sharing them are sorted by position) and longest common prefixes are limited to max_depth.
+ */
+struct suffix_array_t {
+  uint32_t *sa;
+  uint32_t *rank;
+  uint32_t *lcp;
+  size_t len;
+};
+
+struct suffix_array_t *suffix_array_create(const unsigned char *text, size_t len, size_t max_depth);
+void suffix_array_free(struct suffix_array_t *sa);
+
+#endif
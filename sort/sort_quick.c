@@ -15,19 +15,19 @@ static inline void swap(void *e1, void *e2, void *tmp, size_t item_size)
 }
 
 /*
- * Recursive quick sort.
+ * Recursive quick sort (tmp holds 2 items : swap buffer and pivot).
  */
 static void __quick_sort(void *data, int size, size_t item_size, void *tmp,
                          int (*compare)(const void *, const void *))
 {
-  void *pivot;
+  void *pivot = tmp + item_size;
   int i, j;
 
   if (size < 2)
     return;
 
-  /* choose pivot */
-  pivot = data + (size / 2) * item_size;
+  /* choose pivot (copy it : its slot may be swapped) */
+  memcpy(pivot, data + (size / 2) * item_size, item_size);
 
   /* sort */
   for (i = 0, j = size - 1;; i++, j--) {
@@ -63,7 +63,7 @@ void sort_quick(void *data, int size, size_t item_size, int (*compare)(const voi
     return;
 
   /* allocate tmp */
-  tmp = xmalloc(item_size);
+  tmp = xmalloc(2 * item_size);
 
   /* quick sort */
   __quick_sort(data, size, item_size, tmp, compare);
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/*
+ * Number of count tables : consecutive bytes are counted in different tables, so that a repeated byte
+ * doesn't wait for the previous increment of the same counter (store to load forwarding).
+ */
+#define HISTOGRAM_NB_BANKS      4
+
+/*
+ * Maximum bytes counted in 32 bits tables before adding them to the result.
+ */
+#define HISTOGRAM_CHUNK_SIZE    ((size_t) 1 << 30)
+
+/*
+ * Count bytes of a chunk in 4 tables (8 bytes are loaded at once).
+ */
+static void histogram_count_chunk(const unsigned char *buf, size_t len,
+                                  uint32_t banks[HISTOGRAM_NB_BANKS][HISTOGRAM_SIZE])
+{
+  size_t i;
+  uint64_t v;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy(&v, buf + i, sizeof(uint64_t));
+    banks[0][v & 0xFF]++;
+    banks[1][(v >> 8) & 0xFF]++;
+    banks[2][(v >> 16) & 0xFF]++;
+    banks[3][(v >> 24) & 0xFF]++;
+    banks[0][(v >> 32) & 0xFF]++;
+    banks[1][(v >> 40) & 0xFF]++;
+    banks[2][(v >> 48) & 0xFF]++;
+    banks[3][v >> 56]++;
+  }
+
+  /* remaining bytes */
+  for (; i < len; i++)
+    banks[0][buf[i]]++;
+}
+
+/*
+ * Count every byte value of a buffer (counts are added to count, which holds HISTOGRAM_SIZE values).
+ */
+void histogram_count(const unsigned char *buf, size_t len, size_t *count)
+{
+  uint32_t banks[HISTOGRAM_NB_BANKS][HISTOGRAM_SIZE];
+  size_t i, j, n;
+
+  for (; len > 0; buf += n, len -= n) {
+    n = len < HISTOGRAM_CHUNK_SIZE ? len : HISTOGRAM_CHUNK_SIZE;
+
+    /* count chunk */
+    memset(banks, 0, sizeof(banks));
+    histogram_count_chunk(buf, n, banks);
+
+    /* merge tables */
+    for (i = 0; i < HISTOGRAM_SIZE; i++)
+      for (j = 0; j < HISTOGRAM_NB_BANKS; j++)
+        count[i] += banks[j][i];
+  }
+}
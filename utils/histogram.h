@@ -0,0 +1,10 @@
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+#include <stdio.h>
+
+#define HISTOGRAM_SIZE          256
+
+void histogram_count(const unsigned char *buf, size_t len, size_t *count);
+
+#endif
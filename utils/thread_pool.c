@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "mem.h"
+
+/*
+ * Thread pool job.
+ */
+struct thread_pool_job_t {
+  void (*func)(void *);
+  void *arg;
+};
+
+/*
+ * Get number of online processors.
+ */
+int thread_pool_nb_cpus()
+{
+  long n;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+}
+
+/*
+ * Worker thread : run jobs until the pool is stopped.
+ */
+static void *thread_pool_worker(void *arg)
+{
+  struct thread_pool_t *pool = (struct thread_pool_t *) arg;
+  struct thread_pool_job_t *job;
+
+  for (;;) {
+    /* wait for a job */
+    pthread_mutex_lock(&pool->lock);
+    while (queue_is_empty(pool->jobs) && !pool->stop)
+      pthread_cond_wait(&pool->job_available, &pool->lock);
+
+    /* pool stopped */
+    if (queue_is_empty(pool->jobs)) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+
+    /* get next job */
+    job = (struct thread_pool_job_t *) queue_pop_head(pool->jobs);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* run job */
+    job->func(job->arg);
+    free(job);
+
+    /* notify waiters if all jobs are done */
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->nb_pending == 0)
+      pthread_cond_broadcast(&pool->jobs_done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+/*
+ * Create a thread pool (nb_threads <= 0 = one thread per processor).
+ */
+struct thread_pool_t *thread_pool_create(int nb_threads)
+{
+  struct thread_pool_t *pool;
+  int i;
+
+  if (nb_threads <= 0)
+    nb_threads = thread_pool_nb_cpus();
+
+  pool = (struct thread_pool_t *) xmalloc(sizeof(struct thread_pool_t));
+  pool->threads = (pthread_t *) xmalloc(sizeof(pthread_t) * nb_threads);
+  pool->nb_threads = 0;
+  pool->jobs = queue_create();
+  pool->nb_pending = 0;
+  pool->stop = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->job_available, NULL);
+  pthread_cond_init(&pool->jobs_done, NULL);
+
+  /* start workers */
+  for (i = 0; i < nb_threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, pool) != 0)
+      break;
+
+    pool->nb_threads++;
+  }
+
+  /* no worker */
+  if (!pool->nb_threads) {
+    thread_pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+/*
+ * Free a thread pool (pending jobs are run before).
+ */
+void thread_pool_free(struct thread_pool_t *pool)
+{
+  int i;
+
+  if (!pool)
+    return;
+
+  /* stop workers */
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->job_available);
+  pthread_mutex_unlock(&pool->lock);
+
+  /* wait for workers */
+  for (i = 0; i < pool->nb_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  /* free pool */
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->job_available);
+  pthread_cond_destroy(&pool->jobs_done);
+  queue_free_full(pool->jobs, free);
+  free(pool->threads);
+  free(pool);
+}
+
+/*
+ * Submit a job to a thread pool.
+ */
+void thread_pool_submit(struct thread_pool_t *pool, void (*func)(void *), void *arg)
+{
+  struct thread_pool_job_t *job;
+
+  /* create job */
+  job = (struct thread_pool_job_t *) xmalloc(sizeof(struct thread_pool_job_t));
+  job->func = func;
+  job->arg = arg;
+
+  /* queue job */
+  pthread_mutex_lock(&pool->lock);
+  queue_push_tail(pool->jobs, job);
+  pool->nb_pending++;
+  pthread_cond_signal(&pool->job_available);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Wait for all submitted jobs.
+ */
+void thread_pool_wait(struct thread_pool_t *pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  while (pool->nb_pending > 0)
+    pthread_cond_wait(&pool->jobs_done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,26 @@
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "../data_structures/queue.h"
+
+struct thread_pool_t {
+  pthread_t *threads;
+  int nb_threads;
+  struct queue_t *jobs;
+  size_t nb_pending;
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t job_available;
+  pthread_cond_t jobs_done;
+};
+
+int thread_pool_nb_cpus();
+struct thread_pool_t *thread_pool_create(int nb_threads);
+void thread_pool_free(struct thread_pool_t *pool);
+void thread_pool_submit(struct thread_pool_t *pool, void (*func)(void *), void *arg);
+void thread_pool_wait(struct thread_pool_t *pool);
+
+#endif